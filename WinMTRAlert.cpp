@@ -0,0 +1,235 @@
+//*****************************************************************************
+// FILE:            WinMTRAlert.cpp
+//
+//*****************************************************************************
+#include "pch.h"
+#include "WinMTRAlert.h"
+#include <winhttp.h>
+#include <process.h>
+
+#pragma comment(lib, "winhttp.lib")
+
+//*****************************************************************************
+// ParseAlertRules
+//
+// False (and no rule) on the first malformed one
+//*****************************************************************************
+bool ParseAlertRules(const char* spec, std::vector<s_alertrule>& rules)
+{
+	rules.clear();
+	std::string s(spec);
+	size_t start = 0;
+	while(start < s.size()) {
+		size_t end = s.find(',', start);
+		if(end == std::string::npos) end = s.size();
+		std::string item = s.substr(start, end - start);
+		start = end + 1;
+		if(item.empty()) continue;
+
+		s_alertrule rule;
+		rule.dest = !item.compare(0, 5, "dest:");
+		if(rule.dest) item.erase(0, 5);
+		char metric[8];
+		int used = 0;
+		if(sscanf(item.c_str(), "%7[a-z0-9]>%lf%n", metric, &rule.threshold, &used) != 2 || rule.threshold < 0) {
+			rules.clear();
+			return false;
+		}
+		if(!strcmp(metric, "loss")) rule.metric = ALERT_LOSS;
+		else if(!strcmp(metric, "p95")) rule.metric = ALERT_P95;
+		else {
+			rules.clear();
+			return false;
+		}
+		rule.seconds = ALERT_DEFAULT_SECONDS;
+		if(item[used] == ':' && (sscanf(item.c_str() + used + 1, "%d", &rule.seconds) != 1 || rule.seconds < 0)) {
+			rules.clear();
+			return false;
+		}
+		if(rules.size() < ALERT_MAX_RULES) rules.push_back(rule);
+	}
+	return true;
+}
+
+// e.g. "destination p95 > 200 ms for 60 s"
+std::string AlertRuleText(const s_alertrule& rule)
+{
+	char buf[100];
+	sprintf(buf, "%s%s > %g%s for %d s", rule.dest ? "destination " : "", rule.metric == ALERT_LOSS ? "loss" : "p95",
+		rule.threshold, rule.metric == ALERT_LOSS ? "%" : " ms", rule.seconds);
+	return buf;
+}
+
+void HopAlert::Reset()
+{
+	n = 0;
+	replies = 0;
+	loss = 0;
+	p95 = 0;
+	for(int r = 0; r < ALERT_MAX_RULES; ++r) {
+		raised[r] = false;
+		since[r] = 0;
+	}
+}
+
+//*****************************************************************************
+// HopAlert::Update
+//
+// One probe of the hop (rtt -1: lost) at now (ms, monotonic). Fills changes
+// with the rules that were raised or cleared by it, returns their number.
+//*****************************************************************************
+int HopAlert::Update(const std::vector<s_alertrule>& rules, int rtt, bool dest, unsigned long long now, s_alertchange* changes)
+{
+	loss += ((rtt < 0 ? 1.0 : 0.0) - loss) / (n < (1 << ALERT_LOSS_SHIFT) ? n + 1 : 1 << ALERT_LOSS_SHIFT);
+	++n;
+	if(rtt >= 0) {
+		if(!replies++) {
+			p95 = rtt;
+		} else {
+			double step = p95 * ALERT_P95_RATE > 1.0 ? p95 * ALERT_P95_RATE : 1.0;
+			p95 += rtt > p95 ? step * 0.95 : -step * 0.05;// settles where 5% of the RTTs are above
+		}
+	}
+
+	int nc = 0;
+	for(size_t r = 0; r < rules.size() && r < ALERT_MAX_RULES; ++r) {
+		const s_alertrule& rule = rules[r];
+		if(rule.dest && !dest) continue;
+		double value = rule.metric == ALERT_LOSS ? loss * 100 : p95;
+		if(rule.metric == ALERT_P95 && !replies) continue;
+		bool toward = raised[r] ? value < rule.threshold * ALERT_CLEAR_RATIO : value >= rule.threshold;
+		if(!toward) {
+			since[r] = 0;
+			continue;
+		}
+		if(!since[r]) since[r] = now;
+		if(now - since[r] < (unsigned long long)rule.seconds * 1000) continue;
+		raised[r] = !raised[r];
+		since[r] = 0;
+		changes[nc].rule = (int)r;
+		changes[nc].raised = raised[r];
+		changes[nc].value = (int)(value + 0.5);
+		++nc;
+	}
+	return nc;
+}
+
+bool HopAlert::Raised() const
+{
+	for(int r = 0; r < ALERT_MAX_RULES; ++r)
+		if(raised[r]) return true;
+	return false;
+}
+
+struct alert_hook {
+	std::string hook;
+	std::string summary;
+	std::string alerts;		// one per line
+};
+
+// POSTs {"text": message} to an http(s) URL
+static void PostWebhook(const std::string& url, const std::string& message)
+{
+	std::wstring wurl(url.begin(), url.end());
+	URL_COMPONENTS uc = { 0 };
+	wchar_t host[256], path[2048], extra[2048];
+	uc.dwStructSize = sizeof(uc);
+	uc.lpszHostName = host;
+	uc.dwHostNameLength = 256;
+	uc.lpszUrlPath = path;
+	uc.dwUrlPathLength = 2048;
+	uc.lpszExtraInfo = extra;
+	uc.dwExtraInfoLength = 2048;
+	if(!WinHttpCrackUrl(wurl.c_str(), 0, 0, &uc)) return;
+	std::wstring object = std::wstring(path) + extra;// path and query
+
+	std::string body = "{\"text\": \"";
+	for(size_t i = 0; i < message.size(); ++i) {
+		if(message[i] == '"' || message[i] == '\\') body += '\\';
+		if(message[i] == '\n') body += "\\n";
+		else if((unsigned char)message[i] >= ' ') body += message[i];
+	}
+	body += "\"}";
+
+	HINTERNET session = WinHttpOpen(L"WinMTR", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+	HINTERNET connect = session ? WinHttpConnect(session, host, uc.nPort, 0) : NULL;
+	HINTERNET request = connect ? WinHttpOpenRequest(connect, L"POST", object.c_str(), NULL, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES,
+		uc.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0) : NULL;
+	if(request && WinHttpSendRequest(request, L"Content-Type: application/json\r\n", (DWORD)-1L, (LPVOID)body.c_str(), (DWORD)body.size(), (DWORD)body.size(), 0))
+		WinHttpReceiveResponse(request, NULL);
+	if(request) WinHttpCloseHandle(request);
+	if(connect) WinHttpCloseHandle(connect);
+	if(session) WinHttpCloseHandle(session);
+}
+
+// text without quotes, separators or escapes, for a command line
+static std::string CommandText(const std::string& text)
+{
+	std::string safe;
+	for(size_t i = 0; i < text.size(); ++i) {
+		char c = text[i];
+		if((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c && strchr(" .:%>()-", c)))
+			safe += c;
+	}
+	return safe;
+}
+
+// environment of the process with ALERT_HOOK_VARIABLE set to alerts
+static std::vector<char> HookEnvironment(const std::string& alerts)
+{
+	static const char name[] = ALERT_HOOK_VARIABLE "=";
+	std::vector<char> env;
+	LPCH cur = GetEnvironmentStrings();
+	for(LPCH v = cur; v && *v; v += strlen(v) + 1)
+		if(_strnicmp(v, name, sizeof(name) - 1))
+			env.insert(env.end(), v, v + strlen(v) + 1);
+	if(cur) FreeEnvironmentStrings(cur);
+	env.insert(env.end(), name, name + sizeof(name) - 1);
+	env.insert(env.end(), alerts.begin(), alerts.end());
+	env.push_back('\0');
+	env.push_back('\0');
+	return env;
+}
+
+static void AlertHookThread(void* p)
+{
+	alert_hook* ah = (alert_hook*)p;
+	if(!ah->hook.compare(0, 7, "http://") || !ah->hook.compare(0, 8, "https://")) {
+		PostWebhook(ah->hook, ah->alerts);
+	} else {
+		std::string cmd = ah->hook;
+		size_t pos = cmd.find("{message}");
+		if(pos != std::string::npos) cmd.replace(pos, 9, CommandText(ah->summary));
+		std::vector<char> env = HookEnvironment(ah->alerts);
+		STARTUPINFO si = { sizeof(si) };
+		PROCESS_INFORMATION pi;
+		std::vector<char> line(cmd.begin(), cmd.end());
+		line.push_back('\0');
+		if(CreateProcess(NULL, &line[0], NULL, NULL, FALSE, CREATE_NO_WINDOW, &env[0], NULL, &si, &pi)) {
+			CloseHandle(pi.hThread);
+			CloseHandle(pi.hProcess);
+		}
+	}
+	delete ah;
+}
+
+//*****************************************************************************
+// RunAlertHook
+//
+// Runs the hook in the background for a batch of alerts. An http(s) URL
+// gets them POSTed as JSON, one per line. Anything else is a command line
+// run once: the alerts are in its ALERT_HOOK_VARIABLE environment variable,
+// and "{message}" is replaced by the one line summary stripped down to
+// letters, digits and " .:%>()-". Host names come from DNS and never reach
+// the command line as they are.
+//*****************************************************************************
+void RunAlertHook(const std::string& hook, const std::string& summary, const std::vector<std::string>& alerts)
+{
+	if(hook.empty()) return;
+	alert_hook* ah = new alert_hook;
+	ah->hook = hook;
+	ah->summary = summary;
+	for(size_t a = 0; a < alerts.size(); ++a)
+		ah->alerts += (a ? "\n" : "") + alerts[a];
+	_beginthread(AlertHookThread, 0, ah);
+}
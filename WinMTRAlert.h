@@ -0,0 +1,79 @@
+//*****************************************************************************
+// FILE:            WinMTRAlert.h
+//
+//
+// DESCRIPTION:
+//   Threshold alerts: "loss or p95 latency at a hop (or at the destination)
+//   stays above a threshold for some duration", evaluated on every probe.
+//
+// NOTES:
+//   Rules are written as a comma separated list of
+//     [dest:]metric>threshold[:seconds]
+//   with metric "loss" (%) or "p95" (ms), e.g. "loss>10:30,dest:p95>200:60".
+//   HopAlert has a single writer, the probe thread of the hop; transitions
+//   reach the dialog as hop events, which notifies and runs the hook.
+//
+//*****************************************************************************
+
+#ifndef WINMTRALERT_H_
+#define WINMTRALERT_H_
+
+#define ALERT_MAX_RULES			8
+#define ALERT_DEFAULT_SECONDS	30		// duration of a rule without one
+#define ALERT_CLEAR_RATIO		0.8		// a raised rule clears below this share of its threshold
+#define ALERT_LOSS_SHIFT		5		// loss rate smoothed over ~32 probes
+#define ALERT_P95_RATE			0.02	// step of the p95 estimate, share of its value
+#define ALERT_NOTIFY_SECONDS	60		// at most one notification (balloon, hook) per period
+#define ALERT_HOOK_VARIABLE		"WINMTR_ALERTS"	// environment of a hook command: the alerts, one per line
+
+enum ALERT_METRICS {
+	ALERT_LOSS,
+	ALERT_P95
+};
+
+struct s_alertrule {
+	int		metric;		// ALERT_METRICS
+	bool	dest;		// destination only, else every hop
+	double	threshold;	// % or ms
+	int		seconds;	// the condition has to hold that long, both ways
+};
+
+// Rule state change of a hop, see HopAlert::Update
+struct s_alertchange {
+	int		rule;		// index in the rule list
+	bool	raised;		// else cleared
+	int		value;		// metric when it changed, % or ms
+};
+
+bool ParseAlertRules(const char* spec, std::vector<s_alertrule>& rules);
+std::string AlertRuleText(const s_alertrule& rule);
+
+//*****************************************************************************
+// CLASS:  HopAlert
+//
+// Smoothed loss rate and streaming p95 estimate of a hop (stochastic
+// approximation: O(1) per probe, no rescan of the histogram), and where
+// each rule stands: a rule is raised once its metric stayed at or above
+// the threshold for its duration, and cleared once it stayed below
+// ALERT_CLEAR_RATIO of it for the same duration.
+//*****************************************************************************
+
+class HopAlert
+{
+public:
+	void	Reset();
+	int		Update(const std::vector<s_alertrule>& rules, int rtt, bool dest, unsigned long long now, s_alertchange* changes);
+	bool	Raised() const;
+
+private:
+	unsigned long long	n;			// probes seen
+	unsigned long long	replies;
+	double	loss;				// 0..1
+	double	p95;				// ms
+	bool	raised[ALERT_MAX_RULES];
+	unsigned long long	since[ALERT_MAX_RULES];	// ms, start of the run toward the other state, 0 if none
+};
+
+void RunAlertHook(const std::string& hook, const std::string& summary, const std::vector<std::string>& alerts);
+
+#endif	// ifndef WINMTRALERT_H_
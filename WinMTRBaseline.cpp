@@ -0,0 +1,250 @@
+//*****************************************************************************
+// FILE:            WinMTRBaseline.cpp
+//
+//*****************************************************************************
+#include "pch.h"
+#include "WinMTRGlobal.h"
+#include "WinMTRNet.h"
+#include "WinMTRBaseline.h"
+
+BaselineStore baselines;
+
+BaselineProfile::BaselineProfile()
+{
+	InitializeSRWLock(&lock);
+	memset(slots, 0, sizeof(slots));
+}
+
+int BaselineProfile::Bucket(int rtt)
+{
+	if(rtt < BASELINE_EXACT) return rtt;
+	int e = 4;// highest bit of rtt, BASELINE_EXACT is 1 << 4
+	while(e < 30 && rtt >> (e + 1)) ++e;
+	int b = BASELINE_EXACT + (e - 4) * 8 + ((rtt >> (e - 3)) & 7);
+	return b < BASELINE_BUCKETS ? b : BASELINE_BUCKETS - 1;
+}
+
+int BaselineProfile::Lower(int bucket)
+{
+	if(bucket < BASELINE_EXACT) return bucket;
+	int e = (bucket - BASELINE_EXACT) / 8 + 4;
+	return (8 + (bucket - BASELINE_EXACT) % 8) << (e - 3);
+}
+
+// linear inside the bucket, the last one reads as its lower bound
+int BaselineProfile::Percentile(const s_baselineslot& s, int pct)
+{
+	unsigned long long replies = s.total - s.lost, rank = (replies * pct + 99) / 100, seen = 0;
+	if(!replies) return 0;
+	for(int b = 0; b < BASELINE_BUCKETS - 1; ++b) {
+		if(s.counts[b] && seen + s.counts[b] >= rank)
+			return Lower(b) + (int)((Lower(b + 1) - Lower(b)) * (rank - seen - 1) / s.counts[b]);
+		seen += s.counts[b];
+	}
+	return Lower(BASELINE_BUCKETS - 1);
+}
+
+//*****************************************************************************
+// BaselineProfile::Add
+//
+// One probe in an hour slot and in the week slot (rtt -1: lost). A slot
+// full of BASELINE_MAX_SAMPLES (the week one: BASELINE_SLOTS / 7 times
+// more) halves its counts, so the profile follows slow drifts.
+//*****************************************************************************
+void BaselineProfile::Add(int slot, int rtt)
+{
+	int b = rtt < 0 ? -1 : Bucket(rtt);
+	for(int i = 0; i < 2; ++i) {
+		s_baselineslot& s = slots[i ? BASELINE_SLOTS : slot];
+		if(s.total >= (i ? BASELINE_MAX_SAMPLES * (BASELINE_SLOTS / 7) : BASELINE_MAX_SAMPLES)) {
+			for(int k = 0; k < BASELINE_BUCKETS; ++k) s.counts[k] >>= 1;
+			s.lost >>= 1;
+			s.total = s.lost;
+			for(int k = 0; k < BASELINE_BUCKETS; ++k) s.total += s.counts[k];
+		}
+		++s.total;
+		if(b < 0) ++s.lost;
+		else ++s.counts[b];
+	}
+}
+
+//*****************************************************************************
+// BaselineProfile::Reference
+//
+// Median, p50 -> p90 spread and loss rate of the hour slot, or of the whole
+// week while the hour has too few probes. False if neither has enough.
+//*****************************************************************************
+bool BaselineProfile::Reference(int slot, s_baselineref* ref) const
+{
+	const s_baselineslot* s = &slots[slot];
+	if(s->total - s->lost < BASELINE_MIN_SAMPLES) s = &slots[BASELINE_SLOTS];
+	if(s->total - s->lost < BASELINE_MIN_SAMPLES) return false;
+	ref->p50 = Percentile(*s, 50);
+	ref->spread = Percentile(*s, 90) - ref->p50;
+	if(ref->spread < BASELINE_MIN_SPREAD) ref->spread = BASELINE_MIN_SPREAD;
+	ref->loss = (double)s->lost / s->total;
+	return true;
+}
+
+BaselineStore::BaselineStore()
+{
+	InitializeSRWLock(&lock);
+}
+
+BaselineStore::~BaselineStore()
+{
+	for(std::unordered_map<unsigned long long, BaselineProfile*>::iterator it = profiles.begin(); it != profiles.end(); ++it)
+		delete it->second;
+}
+
+// hour of the week, local time, Sunday 0h is 0
+int BaselineStore::Slot(time_t t)
+{
+	tm lt;
+	if(localtime_s(&lt, &t)) return 0;
+	return lt.tm_wday * 24 + lt.tm_hour;
+}
+
+//*****************************************************************************
+// BaselineStore::Get
+//
+// Profile of a (target, responder) pair, created empty the first time
+//*****************************************************************************
+BaselineProfile* BaselineStore::Get(unsigned target, unsigned responder)
+{
+	unsigned long long key = (unsigned long long)target << 32 | responder;
+	AcquireSRWLockShared(&lock);
+	std::unordered_map<unsigned long long, BaselineProfile*>::const_iterator it = profiles.find(key);
+	BaselineProfile* found = it == profiles.end() ? NULL : it->second;
+	ReleaseSRWLockShared(&lock);
+	if(found) return found;
+
+	AcquireSRWLockExclusive(&lock);
+	BaselineProfile*& p = profiles[key];
+	if(!p) p = new BaselineProfile;
+	BaselineProfile* profile = p;
+	ReleaseSRWLockExclusive(&lock);
+	return profile;
+}
+
+//*****************************************************************************
+// BaselineStore::Score
+//
+// Reference of a live probe (rtt -1: lost) for the current hour, taken
+// before the probe itself is learned. False if the profile is too young.
+// Only the lock of the profile is taken: probes of other pairs go on.
+//*****************************************************************************
+bool BaselineStore::Score(BaselineProfile* profile, int rtt, s_baselineref* ref)
+{
+	int slot = Slot(time(NULL));
+	AcquireSRWLockExclusive(&profile->lock);
+	bool known = profile->Reference(slot, ref);
+	profile->Add(slot, rtt);
+	ReleaseSRWLockExclusive(&profile->lock);
+	return known;
+}
+
+//*****************************************************************************
+// BaselineStore::Load
+//
+// File format, after the BASELINE_MAGIC line:
+//   profile <tab> target address <tab> responder address
+//   slot <tab> probes <tab> lost <tab> bucket:replies ... (space separated)
+// Slots of a profile follow it, empty slots and buckets are not written.
+//*****************************************************************************
+bool BaselineStore::Load(const char* path)
+{
+	FILE* fp = fopen(path, "rt");
+	if(fp == NULL) return false;
+	char line[4096];
+	if(!fgets(line, sizeof(line), fp) || strncmp(line, BASELINE_MAGIC, strlen(BASELINE_MAGIC))) {
+		fclose(fp);
+		return false;
+	}
+	BaselineProfile* profile = NULL;
+	while(fgets(line, sizeof(line), fp)) {
+		char target[NI_MAXHOST], responder[NI_MAXHOST];
+		if(sscanf(line, "profile\t%1024[^\t]\t%1024[^\t\r\n]", target, responder) == 2) {
+			profile = NULL;
+			addrinfo hints = { 0 }, *t = NULL, *r = NULL;
+			hints.ai_flags = AI_NUMERICHOST;
+			if(!getaddrinfo(target, NULL, &hints, &t) && !getaddrinfo(responder, NULL, &hints, &r))
+				profile = Get(addresses.Intern(t->ai_addr), addresses.Intern(r->ai_addr));
+			if(t) freeaddrinfo(t);
+			if(r) freeaddrinfo(r);
+			continue;
+		}
+		int slot, n, b, used;
+		unsigned count;
+		s_baselineslot s;
+		memset(&s, 0, sizeof(s));
+		if(!profile || sscanf(line, "%d\t%u\t%u%n", &slot, &s.total, &s.lost, &n) != 3 || slot < 0 || slot > BASELINE_SLOTS) continue;
+		for(const char* p = line + n; sscanf(p, " %d:%u%n", &b, &count, &used) == 2; p += used)
+			if(b >= 0 && b < BASELINE_BUCKETS) s.counts[b] = count;
+		AcquireSRWLockExclusive(&profile->lock);// traces may be probing already
+		profile->slots[slot] = s;
+		ReleaseSRWLockExclusive(&profile->lock);
+	}
+	fclose(fp);
+	return true;
+}
+
+//*****************************************************************************
+// BaselineStore::Save
+//
+// The profiles are copied one at a time under their own lock, then written
+// with no lock held: probes are never stalled by the disk or the address
+// formatting. Written aside then moved over the previous file, so a crash
+// never leaves a truncated baseline.
+//*****************************************************************************
+bool BaselineStore::Save(const char* path)
+{
+	std::vector<std::pair<unsigned long long, BaselineProfile*> > list;
+	AcquireSRWLockShared(&lock);
+	list.assign(profiles.begin(), profiles.end());
+	ReleaseSRWLockShared(&lock);
+
+	struct s_savedslot {
+		int slot;
+		s_baselineslot s;
+	};
+	std::vector<s_savedslot> saved;
+	std::vector<size_t> first(list.size() + 1);// saved slots of list[i]: first[i] .. first[i + 1]
+	for(size_t i = 0; i < list.size(); ++i) {
+		first[i] = saved.size();
+		BaselineProfile* profile = list[i].second;
+		AcquireSRWLockShared(&profile->lock);
+		for(int slot = 0; slot <= BASELINE_SLOTS; ++slot) {
+			if(!profile->slots[slot].total) continue;
+			s_savedslot copy;
+			copy.slot = slot;
+			copy.s = profile->slots[slot];
+			saved.push_back(copy);
+		}
+		ReleaseSRWLockShared(&profile->lock);
+	}
+	first[list.size()] = saved.size();
+
+	std::string tmp = std::string(path) + ".tmp";
+	FILE* fp = fopen(tmp.c_str(), "wt");
+	if(fp == NULL) return false;
+	fprintf(fp, "%s\n", BASELINE_MAGIC);
+	for(size_t i = 0; i < list.size(); ++i) {
+		char target[NI_MAXHOST], responder[NI_MAXHOST];
+		if(first[i] == first[i + 1]
+			|| getnameinfo(addresses.Get((unsigned)(list[i].first >> 32)), sizeof(sockaddr_in6), target, NI_MAXHOST, NULL, 0, NI_NUMERICHOST)
+			|| getnameinfo(addresses.Get((unsigned)list[i].first), sizeof(sockaddr_in6), responder, NI_MAXHOST, NULL, 0, NI_NUMERICHOST))
+			continue;
+		fprintf(fp, "profile\t%s\t%s\n", target, responder);
+		for(size_t k = first[i]; k < first[i + 1]; ++k) {
+			const s_baselineslot& s = saved[k].s;
+			fprintf(fp, "%d\t%u\t%u", saved[k].slot, s.total, s.lost);
+			for(int b = 0; b < BASELINE_BUCKETS; ++b)
+				if(s.counts[b]) fprintf(fp, " %d:%u", b, s.counts[b]);
+			fputc('\n', fp);
+		}
+	}
+	bool ok = !ferror(fp);
+	ok = !fclose(fp) && ok;
+	return ok && MoveFileEx(tmp.c_str(), path, MOVEFILE_REPLACE_EXISTING);
+}
@@ -0,0 +1,99 @@
+//*****************************************************************************
+// FILE:            WinMTRBaseline.h
+//
+//
+// DESCRIPTION:
+//   What is normal for a hop: RTT distribution and loss rate of every
+//   (target, responder) pair by hour of the week, kept on disk across
+//   sessions. Live samples are scored against it as they come in.
+//
+// NOTES:
+//   Profiles are shared by every trace of the process and updated by the
+//   probe threads, each under its own lock; the store lock only guards the
+//   profile map. Pointers to profiles stay valid until exit.
+//
+//*****************************************************************************
+
+#ifndef WINMTRBASELINE_H_
+#define WINMTRBASELINE_H_
+
+#include <unordered_map>
+
+#define BASELINE_SLOTS			168		// hours of the week, then one slot for the whole week
+#define BASELINE_EXACT			16		// RTT buckets: 1 ms wide below, then 8 per octave (~9%)
+#define BASELINE_BUCKETS		88		// up to 8 s, longer RTTs land in the last bucket
+#define BASELINE_MIN_SAMPLES	60		// probes before a slot is trusted, else the whole week is used
+#define BASELINE_MAX_SAMPLES	20000	// counts of an hour slot are halved past this, old weeks fade out
+#define BASELINE_MIN_SPREAD		2		// ms, floor of the p50 -> p90 spread a deviation is measured in
+#define BASELINE_CLIP			4.0		// largest deviation a single probe adds, in spreads
+#define BASELINE_EWMA_SHIFT		4		// live deviation averaged over ~16 probes
+#define BASELINE_ABNORMAL		2.0		// live deviation flagging a hop abnormal, in spreads
+#define BASELINE_NORMAL			1.0		// and the one clearing it
+#define BASELINE_LOSS_MARGIN	0.10	// live loss rate over the baseline one flagged abnormal
+#define BASELINE_FILE			"baselines.txt"
+#define BASELINE_MAGIC			"# WinMTR baselines 1"
+
+// Probes of one hour of the week
+struct s_baselineslot {
+	unsigned counts[BASELINE_BUCKETS];	// replies by RTT bucket
+	unsigned total;			// probes, lost ones included
+	unsigned lost;
+};
+
+// Reference of a sample, see BaselineStore::Score
+struct s_baselineref {
+	int p50;				// ms
+	int spread;				// p90 - p50, at least BASELINE_MIN_SPREAD
+	double loss;			// 0..1
+};
+
+//*****************************************************************************
+// CLASS:  BaselineProfile
+//
+// RTT histogram and loss count of one (target, responder) pair, for every
+// hour of the week and for the whole week
+//*****************************************************************************
+
+class BaselineProfile
+{
+public:
+	BaselineProfile();
+	void	Add(int slot, int rtt);
+	bool	Reference(int slot, s_baselineref* ref) const;
+
+	SRWLOCK			lock;		// slots
+	s_baselineslot	slots[BASELINE_SLOTS + 1];
+
+private:
+	static int	Bucket(int rtt);
+	static int	Lower(int bucket);
+	static int	Percentile(const s_baselineslot& s, int pct);
+};
+
+//*****************************************************************************
+// CLASS:  BaselineStore
+//
+//
+//*****************************************************************************
+
+class BaselineStore
+{
+public:
+	BaselineStore();
+	~BaselineStore();
+
+	BaselineProfile*	Get(unsigned target, unsigned responder);
+	bool	Score(BaselineProfile* profile, int rtt, s_baselineref* ref);
+	bool	Load(const char* path);
+	bool	Save(const char* path);
+
+	static int	Slot(time_t t);
+
+private:
+	SRWLOCK				lock;		// profiles, not their content
+	std::unordered_map<unsigned long long, BaselineProfile*>	profiles;	// key target << 32 | responder
+};
+
+extern BaselineStore baselines;
+
+#endif	// ifndef WINMTRBASELINE_H_
@@ -11,11 +11,16 @@
 #include <chrono>
 #include <iomanip>
 #include <ctime>
+#include <algorithm>
+#include <climits>
 #include "utility.h"
 #include "WinMTRDialog.h"
 #include "WinMTROptions.h"
 #include "WinMTRProperties.h"
 #include "WinMTRNet.h"
+#include "WinMTRTopology.h"
+#include "WinMTRBaseline.h"
+#include "WinMTRReplay.h"
 
 void PingThread(void* p);
 
@@ -36,9 +41,16 @@ BEGIN_MESSAGE_MAP(WinMTRDialog, CDialog)
 	ON_BN_CLICKED(ID_EXPT, OnEXPT)
 	ON_BN_CLICKED(ID_EXPH, OnEXPH)
 	ON_NOTIFY(NM_DBLCLK, IDC_LIST_MTR, OnDblclkList)
+	ON_NOTIFY(NM_DBLCLK, IDC_LIST_MTR2, OnDblclkList2)
+	ON_NOTIFY(NM_RCLICK, IDC_LIST_MTR, OnRclickList)
+	ON_NOTIFY(NM_RCLICK, IDC_LIST_MTR2, OnRclickList2)
+	ON_NOTIFY(NM_CUSTOMDRAW, IDC_LIST_MTR, OnCustomDrawList)
+	ON_NOTIFY(NM_CUSTOMDRAW, IDC_LIST_MTR2, OnCustomDrawList)
 	ON_CBN_SELCHANGE(IDC_COMBO_HOST, &WinMTRDialog::OnCbnSelchangeComboHost)
 	ON_CBN_SELENDOK(IDC_COMBO_HOST, &WinMTRDialog::OnCbnSelendokComboHost)
 	ON_CBN_CLOSEUP(IDC_COMBO_HOST, &WinMTRDialog::OnCbnCloseupComboHost)
+	ON_CBN_SELCHANGE(IDC_COMBO_TRACE, &WinMTRDialog::OnCbnSelchangeComboTrace)
+	ON_CBN_SELCHANGE(IDC_COMBO_WINDOW, &WinMTRDialog::OnCbnSelchangeComboWindow)
 	ON_WM_TIMER()
 	ON_WM_CLOSE()
 	ON_BN_CLICKED(IDCANCEL, &WinMTRDialog::OnBnClickedCancel)
@@ -125,6 +137,9 @@ void WinMTRDialog::OnTimer(UINT_PTR nIDEvent)
 			{
 				SaveDataListToFile(datalist, newFolderPath);
 				datalist.clear();
+				SaveEventListToFile(newFolderPath);
+				eventlist.clear();
+				baselines.Save(BaselinePath());
 			}
 			else
 			{
@@ -133,9 +148,13 @@ void WinMTRDialog::OnTimer(UINT_PTR nIDEvent)
 		}
 	}
 
-	if (state == EXIT && WaitForSingleObject(traceThreadMutex, 0) == WAIT_OBJECT_0)
+	if (replayJob) ReplayProgress();
+
+	if (state == EXIT && !replayJob && WaitForSingleObject(traceThreadMutex, 0) == WAIT_OBJECT_0)
 	{
 		ReleaseMutex(traceThreadMutex);
+		CString path = BaselinePath();
+		if (!path.IsEmpty()) baselines.Save(path);
 		OnOK();
 	}
 
@@ -178,6 +197,32 @@ void WinMTRDialog::SaveDataListToFile(const std::list<std::string>& datalist, co
 	delete file;
 }
 
+/// <summary>
+/// Saves the change point events to their own file in the specified folder path.
+/// </summary>
+/// <param name="folderPath">The path of the folder where the file will be saved.</param>
+void WinMTRDialog::SaveEventListToFile(const CString& folderPath)
+{
+	if (eventlist.empty())
+	{
+		return;
+	}
+	CStdioFile* file = OS::utility::CreateFile(folderPath, _T("events"));
+	if (file == nullptr)
+	{
+		return;
+	}
+	std::string header = "Date (UTC)" + FIELD_SEPARATOR + "Trace" + FIELD_SEPARATOR + "Nr" + FIELD_SEPARATOR + "Hostname" + FIELD_SEPARATOR + "Event" + FIELD_SEPARATOR + "Before" + FIELD_SEPARATOR + "After\n";
+	file->WriteString(header.c_str());
+	for (const auto& entry : eventlist)
+	{
+		file->WriteString(CString((entry + "\n").c_str()));
+	}
+
+	file->Close();
+	delete file;
+}
+
 /// <summary>
 /// Writes a data entry to the specified file.
 /// </summary>
@@ -206,26 +251,41 @@ WinMTRDialog::WinMTRDialog(CWnd* pParent)
 	m_hIcon = AfxGetApp()->LoadIcon(IDR_MAINFRAME);
 	m_autostart = 0;
 	useDNS = DEFAULT_DNS;
+	useTimestamp = DEFAULT_TIMESTAMP;
+	useDualStack = DEFAULT_DUALSTACK;
+	fanout = DEFAULT_FANOUT;
+	SetDscpClasses(DEFAULT_DSCP);
+	viewTrace = 0;
+	viewWindow = 0;
 	interval = DEFAULT_INTERVAL;
+	minInterval = DEFAULT_MIN_INTERVAL;
 	pingsize = DEFAULT_PING_SIZE;
 	maxLRU = DEFAULT_MAX_LRU;
 	nrLRU = 0;
 
 	hasIntervalFromCmdLine = false;
+	hasMinIntervalFromCmdLine = false;
 	hasPingsizeFromCmdLine = false;
 	hasMaxLRUFromCmdLine = false;
 	hasUseDNSFromCmdLine = false;
 	hasUseIPv6FromCmdLine = false;
+	hasUseTimestampFromCmdLine = false;
+	hasUseDualStackFromCmdLine = false;
+	hasFanoutFromCmdLine = false;
+	hasDscpFromCmdLine = false;
+	hasAlertFromCmdLine = false;
 
 	traceThreadMutex = CreateMutex(NULL, FALSE, NULL);
 	wmtrnet = new WinMTRNet(this);
+	wmtrnets.push_back(wmtrnet);
 	if (!wmtrnet->hasIPv6) m_checkIPv6.EnableWindow(FALSE);
 	useIPv6 = 2;
 }
 
 WinMTRDialog::~WinMTRDialog()
 {
-	delete wmtrnet;
+	ClearTraces();
+	wmtrnet->Release();
 	CloseHandle(traceThreadMutex);
 }
 
@@ -243,6 +303,9 @@ void WinMTRDialog::DoDataExchange(CDataExchange* pDX)
 	DDX_Control(pDX, IDC_COMBO_HOST, m_comboHost);
 	DDX_Control(pDX, IDC_CHECK_IPV6, m_checkIPv6);
 	DDX_Control(pDX, IDC_LIST_MTR, m_listMTR);
+	DDX_Control(pDX, IDC_LIST_MTR2, m_listMTR2);
+	DDX_Control(pDX, IDC_COMBO_TRACE, m_comboTrace);
+	DDX_Control(pDX, IDC_COMBO_WINDOW, m_comboWindow);
 	DDX_Control(pDX, IDC_STATICS, m_staticS);
 	DDX_Control(pDX, IDC_STATICJ, m_staticJ);
 	DDX_Control(pDX, ID_EXPH, m_buttonExpH);
@@ -294,8 +357,16 @@ BOOL WinMTRDialog::OnInitDialog()
 	//	}
 	//}
 
-	for (int i = 0; i < MTR_NR_COLS; i++)
+	for (int i = 0; i < MTR_NR_COLS; i++) {
 		m_listMTR.InsertColumn(i, MTR_COLS[i], LVCFMT_LEFT, MTR_COL_LENGTH[i], -1);
+		m_listMTR2.InsertColumn(i, MTR_COLS[i], LVCFMT_LEFT, MTR_COL_LENGTH[i], -1);
+	}
+	for (int w = 0; w <= NR_WINDOWS; w++)
+		m_comboWindow.AddString(WINDOW_NAMES[w]);
+	m_comboWindow.SetCurSel(viewWindow);
+
+	CString baselinePath = BaselinePath();
+	if (!baselinePath.IsEmpty()) baselines.Load(baselinePath);
 
 	m_comboHost.SetFocus();
 
@@ -391,6 +462,58 @@ BOOL WinMTRDialog::InitRegistry()
 	else {
 		if (!hasUseDNSFromCmdLine) useDNS = (BOOL)tmp_dword;
 	}
+
+	if (RegQueryValueEx(hKey_v, "UseTimestamp", 0, NULL, (unsigned char*)&tmp_dword, &value_size) != ERROR_SUCCESS) {
+		tmp_dword = useTimestamp ? 1 : 0;
+		RegSetValueEx(hKey_v, "UseTimestamp", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
+	}
+	else {
+		if (!hasUseTimestampFromCmdLine) useTimestamp = (BOOL)tmp_dword;
+	}
+
+	if (RegQueryValueEx(hKey_v, "DualStack", 0, NULL, (unsigned char*)&tmp_dword, &value_size) != ERROR_SUCCESS) {
+		tmp_dword = useDualStack ? 1 : 0;
+		RegSetValueEx(hKey_v, "DualStack", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
+	}
+	else {
+		if (!hasUseDualStackFromCmdLine) useDualStack = (BOOL)tmp_dword;
+	}
+
+	if (RegQueryValueEx(hKey_v, "FanOut", 0, NULL, (unsigned char*)&tmp_dword, &value_size) != ERROR_SUCCESS) {
+		tmp_dword = fanout;
+		RegSetValueEx(hKey_v, "FanOut", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
+	}
+	else {
+		if (!hasFanoutFromCmdLine) SetFanout(tmp_dword);
+	}
+
+	char dscp_buf[255];
+	DWORD dscp_size = sizeof(dscp_buf);
+	if (RegQueryValueEx(hKey_v, "DscpClasses", 0, NULL, (unsigned char*)dscp_buf, &dscp_size) != ERROR_SUCCESS) {
+		RegSetValueEx(hKey_v, "DscpClasses", 0, REG_SZ, (const unsigned char*)dscpList.c_str(), (DWORD)dscpList.size() + 1);
+	}
+	else {
+		dscp_buf[sizeof(dscp_buf) - 1] = '\0';
+		if (!hasDscpFromCmdLine) SetDscpClasses(dscp_buf);
+	}
+
+	char alert_buf[1024];
+	DWORD alert_size = sizeof(alert_buf);
+	if (RegQueryValueEx(hKey_v, "AlertRules", 0, NULL, (unsigned char*)alert_buf, &alert_size) != ERROR_SUCCESS) {
+		RegSetValueEx(hKey_v, "AlertRules", 0, REG_SZ, (const unsigned char*)alertSpec.c_str(), (DWORD)alertSpec.size() + 1);
+	}
+	else {
+		alert_buf[sizeof(alert_buf) - 1] = '\0';
+		if (!hasAlertFromCmdLine) SetAlertRules(alert_buf);
+	}
+	alert_size = sizeof(alert_buf);
+	if (RegQueryValueEx(hKey_v, "AlertHook", 0, NULL, (unsigned char*)alert_buf, &alert_size) != ERROR_SUCCESS) {
+		RegSetValueEx(hKey_v, "AlertHook", 0, REG_SZ, (const unsigned char*)"", 1);
+	}
+	else {
+		alert_buf[sizeof(alert_buf) - 1] = '\0';
+		alertHook = alert_buf;
+	}
 	if (RegQueryValueEx(hKey_v, "UseIPv6", 0, NULL, (unsigned char*)&tmp_dword, &value_size) != ERROR_SUCCESS) {
 		tmp_dword = useIPv6;
 		RegSetValueEx(hKey_v, "UseIPv6", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
@@ -408,6 +531,13 @@ BOOL WinMTRDialog::InitRegistry()
 	else {
 		if (!hasIntervalFromCmdLine) interval = (float)tmp_dword / 1000.0;
 	}
+	if (RegQueryValueEx(hKey_v, "MinInterval", 0, NULL, (unsigned char*)&tmp_dword, &value_size) != ERROR_SUCCESS) {
+		tmp_dword = (DWORD)(minInterval * 1000);
+		RegSetValueEx(hKey_v, "MinInterval", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
+	}
+	else {
+		if (!hasMinIntervalFromCmdLine) minInterval = (float)tmp_dword / 1000.0;
+	}
 
 	r = RegCreateKeyEx(hKey, "LRU", 0, NULL, 0, KEY_ALL_ACCESS, NULL, &hKey_v, NULL);
 	if (r != ERROR_SUCCESS)
@@ -489,9 +619,7 @@ void WinMTRDialog::OnSize(UINT nType, int cx, int cy)
 	ScreenToClient(&lb);
 	m_buttonExpT.SetWindowPos(NULL, rct.Width() - lb.Width() - 103, lb.TopLeft().y, lb.Width(), lb.Height(), SWP_NOSIZE | SWP_NOZORDER);
 
-	m_listMTR.GetWindowRect(&lb);
-	ScreenToClient(&lb);
-	m_listMTR.SetWindowPos(NULL, lb.TopLeft().x, lb.TopLeft().y, rct.Width() - 17, rct.Height() - lb.top - 25, SWP_NOMOVE | SWP_NOZORDER);
+	PositionLists();
 
 	RepositionBars(AFX_IDW_CONTROLBAR_FIRST, AFX_IDW_CONTROLBAR_LAST,
 		0, reposQuery, rct);
@@ -501,6 +629,28 @@ void WinMTRDialog::OnSize(UINT nType, int cx, int cy)
 }
 
 
+//*****************************************************************************
+// WinMTRDialog::PositionLists
+//
+// Dual-stack traces get their hop tables side by side
+//*****************************************************************************
+void WinMTRDialog::PositionLists()
+{
+	CRect rct, lb;
+	if (!IsWindow(m_listMTR.m_hWnd)) return;
+	GetClientRect(&rct);
+	m_listMTR.GetWindowRect(&lb);
+	ScreenToClient(&lb);
+	int width = rct.Width() - 17;
+	int height = rct.Height() - lb.top - 25;
+	if (m_listMTR2.IsWindowVisible()) {
+		width = (width - 4) / 2;
+		m_listMTR2.SetWindowPos(NULL, lb.TopLeft().x + width + 4, lb.TopLeft().y, width, height, SWP_NOZORDER);
+	}
+	m_listMTR.SetWindowPos(NULL, lb.TopLeft().x, lb.TopLeft().y, width, height, SWP_NOMOVE | SWP_NOZORDER);
+}
+
+
 //*****************************************************************************
 // WinMTRDialog::OnPaint
 //
@@ -546,36 +696,421 @@ HCURSOR WinMTRDialog::OnQueryDragIcon()
 void WinMTRDialog::OnDblclkList(NMHDR* /*pNMHDR*/, LRESULT* pResult)
 {
 	*pResult = 0;
+	ShowHostProperties(m_listMTR, wmtrnets[viewTrace]);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::OnDblclkList2
+//
+//*****************************************************************************
+void WinMTRDialog::OnDblclkList2(NMHDR* /*pNMHDR*/, LRESULT* pResult)
+{
+	*pResult = 0;
+	if (wmtrnets.size() > 1)
+		ShowHostProperties(m_listMTR2, wmtrnets[1]);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::OnRclickList
+//
+//*****************************************************************************
+void WinMTRDialog::OnRclickList(NMHDR* /*pNMHDR*/, LRESULT* pResult)
+{
+	*pResult = 0;
+	ShowListMenu(m_listMTR, wmtrnets[viewTrace]);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::OnRclickList2
+//
+//*****************************************************************************
+void WinMTRDialog::OnRclickList2(NMHDR* /*pNMHDR*/, LRESULT* pResult)
+{
+	*pResult = 0;
+	if (wmtrnets.size() > 1)
+		ShowListMenu(m_listMTR2, wmtrnets[1]);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::OnCustomDrawList
+//
+// Hops far from their baseline (item data set by DisplayTrace) are shaded
+//*****************************************************************************
+void WinMTRDialog::OnCustomDrawList(NMHDR* pNMHDR, LRESULT* pResult)
+{
+	NMLVCUSTOMDRAW* cd = (NMLVCUSTOMDRAW*)pNMHDR;
+	*pResult = CDRF_DODEFAULT;
+	if (cd->nmcd.dwDrawStage == CDDS_PREPAINT)
+		*pResult = CDRF_NOTIFYITEMDRAW;
+	else if (cd->nmcd.dwDrawStage == CDDS_ITEMPREPAINT && cd->nmcd.lItemlParam)
+		cd->clrTextBk = RGB(255, 210, 210);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::ShowListMenu
+//
+// Context menu of the lists: zero the statistics of the selected hop or of
+// every hop of every trace, without stopping the trace, save / merge
+// statistics files, replay a probe log and export the topology graph of
+// every trace
+//*****************************************************************************
+void WinMTRDialog::ShowListMenu(CListCtrl& list, WinMTRNet* net)
+{
+	enum { ID_RESET_HOP = 1, ID_RESET_ALL, ID_SAVE_STATS, ID_MERGE_STATS, ID_REPLAY_LOG, ID_TOPOLOGY_DOT, ID_TOPOLOGY_JSON };
+	char buf[64];
+	int nItem = -1;
+	POSITION pos = list.GetFirstSelectedItemPosition();
+	if (pos != NULL) nItem = list.GetNextSelectedItem(pos);
+
+	CMenu menu;
+	menu.CreatePopupMenu();
+	UINT flags = state == TRACING ? MF_STRING : MF_STRING | MF_GRAYED;
+	sprintf(buf, nItem >= 0 ? "Reset statistics of hop %d" : "Reset statistics of hop", nItem + 1);
+	menu.AppendMenu(nItem >= 0 ? flags : MF_STRING | MF_GRAYED, ID_RESET_HOP, buf);
+	menu.AppendMenu(flags, ID_RESET_ALL, "Reset all statistics");
+	menu.AppendMenu(MF_SEPARATOR);
+	menu.AppendMenu(wmtrnets.empty() ? MF_STRING | MF_GRAYED : MF_STRING, ID_SAVE_STATS, "Save statistics...");
+	menu.AppendMenu(MF_STRING, ID_MERGE_STATS, "Merge statistics files...");
+	menu.AppendMenu(replayJob ? MF_STRING | MF_GRAYED : MF_STRING, ID_REPLAY_LOG, "Replay probe log...");
+	menu.AppendMenu(MF_SEPARATOR);
+	menu.AppendMenu(MF_STRING, ID_TOPOLOGY_DOT, "Export topology (GraphViz)...");
+	menu.AppendMenu(MF_STRING, ID_TOPOLOGY_JSON, "Export topology (JSON)...");
+
+	CPoint point;
+	GetCursorPos(&point);
+	int cmd = menu.TrackPopupMenu(TPM_LEFTALIGN | TPM_RIGHTBUTTON | TPM_RETURNCMD, point.x, point.y, this);
+	switch (cmd) {
+	case ID_RESET_HOP:
+		net->ResetStats(nItem);
+		break;
+	case ID_RESET_ALL:
+		for (size_t t = 0; t < wmtrnets.size(); ++t) wmtrnets[t]->ResetStats(-1);
+		statusBar.SetPaneText(0, "Statistics reset, the trace goes on.");
+		break;
+	case ID_SAVE_STATS: {
+		CFileDialog dlg(FALSE, _T("wmtrstats"), NULL, OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT | OFN_EXPLORER, STATS_FILTER, this);
+		if (dlg.DoModal() == IDOK && !SaveStats(dlg.GetPathName(), wmtrnets))
+			AfxMessageBox("Unable to save the statistics.");
+		break;
+	}
+	case ID_MERGE_STATS:
+		MergeStats();
+		break;
+	case ID_REPLAY_LOG:
+		ReplayLog();
+		break;
+	case ID_TOPOLOGY_DOT:
+	case ID_TOPOLOGY_JSON: {
+		bool dot = cmd == ID_TOPOLOGY_DOT;
+		CFileDialog dlg(FALSE, dot ? _T("dot") : _T("json"), NULL, OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT | OFN_EXPLORER,
+			dot ? _T("GraphViz (*.dot)|*.dot|All Files (*.*)|*.*||") : _T("JSON (*.json)|*.json|All Files (*.*)|*.*||"), this);
+		if (dlg.DoModal() != IDOK) break;
+		std::string graph = dot ? topology.ToGraphViz() : topology.ToJson();
+		FILE* fp = fopen(dlg.GetPathName(), "wt");
+		if (fp == NULL || fputs(graph.c_str(), fp) < 0)
+			AfxMessageBox("Unable to save the topology.");
+		if (fp != NULL) fclose(fp);
+		break;
+	}
+	}
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::SaveStats
+//
+// Mergeable statistics of every hop of every trace, one line per hop:
+//   trace <tab> label
+//   hop <tab> nr <tab> address <tab> name <tab> HopSummary::Serialize()
+// then the events of the trace if given (replays), which merging ignores:
+//   event <tab> UTC time <tab> hop nr <tab> kind <tab> before <tab> after
+//*****************************************************************************
+bool WinMTRDialog::SaveStats(const char* path, const std::vector<WinMTRNet*>& nets, const std::vector<std::vector<s_hopevent> >* events)
+{
+	FILE* fp = fopen(path, "wt");
+	if (fp == NULL) return false;
+	fprintf(fp, "%s\n", STATS_MAGIC);
+	for (size_t t = 0; t < nets.size(); ++t) {
+		WinMTRNet* net = nets[t];
+		if (!net) continue;
+		std::vector<s_hopsnapshot> hops;
+		int nh = net->GetSnapshot(hops);
+		fprintf(fp, "trace\t%s\n", net->label);
+		for (int i = 0; i < nh; i++) {
+			char addr[NI_MAXHOST];
+			if (!hops[i].addr_id || getnameinfo((const sockaddr*)&hops[i].addr6, sizeof(sockaddr_in6), addr, NI_MAXHOST, NULL, 0, NI_NUMERICHOST))
+				strcpy(addr, "-");
+			HopSummary sum;
+			net->GetSummary(i, &sum);
+			fprintf(fp, "hop\t%d\t%s\t%s\t%s\n", i + 1, addr, *hops[i].name ? hops[i].name : "-", sum.Serialize().c_str());
+		}
+		if (!events || t >= events->size()) continue;
+		for (size_t e = 0; e < (*events)[t].size(); ++e) {
+			const s_hopevent& ev = (*events)[t][e];
+			char when[32];
+			strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime(&ev.time));
+			fprintf(fp, "event\t%s\t%d\t%s\t%d\t%d\n", when, ev.hop + 1, CHANGE_NAMES[ev.kind], ev.before, ev.after);
+		}
+	}
+	bool ok = !ferror(fp);
+	return !fclose(fp) && ok;
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::ReplayLog
+//
+// Replays a probe log with the current interval and alert rules on a
+// thread of its own, see ReplayProbeLog; ReplayProgress picks it up
+//*****************************************************************************
+void WinMTRDialog::ReplayLog()
+{
+	if (replayJob) return;
+	CFileDialog in(TRUE, _T("wmtrlog"), NULL, OFN_HIDEREADONLY | OFN_FILEMUSTEXIST | OFN_EXPLORER, PROBELOG_FILTER, this);
+	if (in.DoModal() != IDOK) return;
+
+	s_replayjob* job = new s_replayjob;
+	job->path = (LPCSTR)in.GetPathName();
+	job->dlg = this;
+	job->percent = 0;
+	job->cancel = false;
+	job->done = false;
+	job->ok = false;
+	replayThread = (HANDLE)_beginthreadex(NULL, 0, ReplayProbeThread, job, 0, NULL);
+	if (!replayThread) {
+		delete job;
+		AfxMessageBox("Unable to start the replay.");
+		return;
+	}
+	replayJob = job;
+	statusBar.SetPaneText(0, "Replaying the probe log: 0%");
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::ReplayProgress
+//
+// Timer side of ReplayLog: shows how far the replay is, then its outcome,
+// and saves the resulting statistics and events. Closing the dialog cancels
+// the replay and drops its results.
+//*****************************************************************************
+void WinMTRDialog::ReplayProgress()
+{
+	s_replayjob* job = replayJob;
+	if (state == EXIT) job->cancel = true;
+	if (!job->done.load(std::memory_order_acquire)) {
+		if (state != EXIT) {
+			char buf[64];
+			sprintf(buf, "Replaying the probe log: %d%%", job->percent.load(std::memory_order_relaxed));
+			statusBar.SetPaneText(0, buf);
+		}
+		return;
+	}
+	// detached first: the dialogs below keep the timer running
+	WaitForSingleObject(replayThread, INFINITE);
+	CloseHandle(replayThread);
+	replayThread = NULL;
+	replayJob = NULL;
+
+	if (state != EXIT && !job->ok)
+		AfxMessageBox("Unable to read the probe log.");
+	else if (state != EXIT) {
+		char buf[200];
+		size_t nev = 0;
+		for (size_t t = 0; t < job->events.size(); ++t) nev += job->events[t].size();
+		sprintf(buf, "Replayed %llu probes in %.2f s (%.1f M/s), %u events, %llu lines skipped%s.", job->st.probes, job->st.seconds,
+			job->st.seconds > 0 ? job->st.probes / job->st.seconds / 1e6 : 0.0, (unsigned)nev, job->st.skipped,
+			job->st.cancelled ? ", cancelled" : "");
+		statusBar.SetPaneText(0, buf);
+
+		CFileDialog out(FALSE, _T("wmtrstats"), NULL, OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT | OFN_EXPLORER, STATS_FILTER, this);
+		if (out.DoModal() == IDOK && !SaveStats(out.GetPathName(), job->nets, &job->events))
+			AfxMessageBox("Unable to save the statistics.");
+	}
+	for (size_t t = 0; t < job->nets.size(); ++t)
+		if (job->nets[t]) job->nets[t]->Release();
+	delete job;
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::MergeStats
+//
+// Combines statistics files of several sessions or sites into one. Traces
+// are matched by label and hops by number; a hop seen at different
+// addresses gets "*" as address.
+//*****************************************************************************
+void WinMTRDialog::MergeStats()
+{
+	struct merged_hop {
+		std::string addr;
+		std::string name;
+		HopSummary sum;
+	};
+	struct merged_trace {
+		std::string label;
+		std::vector<merged_hop> hops;
+	};
+
+	CFileDialog in(TRUE, _T("wmtrstats"), NULL, OFN_HIDEREADONLY | OFN_FILEMUSTEXIST | OFN_ALLOWMULTISELECT | OFN_EXPLORER, STATS_FILTER, this);
+	std::vector<TCHAR> names(64 * 1024);
+	in.m_ofn.lpstrFile = &names[0];
+	in.m_ofn.nMaxFile = (DWORD)names.size();
+	if (in.DoModal() != IDOK) return;
+
+	std::vector<merged_trace> traces;
+	std::vector<char> line(64 * 1024);
+	int files = 0;
+	for (POSITION pos = in.GetStartPosition(); pos != NULL; ) {
+		CString path = in.GetNextPathName(pos);
+		FILE* fp = fopen(path, "rt");
+		if (fp == NULL) continue;
+		if (!fgets(&line[0], (int)line.size(), fp) || strncmp(&line[0], STATS_MAGIC, strlen(STATS_MAGIC))) {
+			fclose(fp);
+			continue;
+		}
+		++files;
+		merged_trace* trace = NULL;
+		while (fgets(&line[0], (int)line.size(), fp)) {
+			line[strcspn(&line[0], "\r\n")] = '\0';
+			std::vector<std::string> fields;
+			for (char* p = &line[0]; p; ) {
+				char* tab = strchr(p, '\t');
+				fields.push_back(tab ? std::string(p, tab - p) : std::string(p));
+				p = tab ? tab + 1 : NULL;
+			}
+			if (fields[0] == "trace" && fields.size() == 2) {
+				size_t t = 0;
+				while (t < traces.size() && traces[t].label != fields[1]) ++t;
+				if (t == traces.size()) {
+					traces.push_back(merged_trace());
+					traces[t].label = fields[1];
+				}
+				trace = &traces[t];
+			}
+			else if (fields[0] == "hop" && fields.size() == 5 && trace) {
+				int nr = atoi(fields[1].c_str());
+				HopSummary sum;
+				if (nr < 1 || nr > MaxHost || !sum.Parse(fields[4].c_str())) continue;
+				if ((int)trace->hops.size() < nr) {
+					size_t from = trace->hops.size();
+					trace->hops.resize(nr);
+					for (size_t h = from; h < trace->hops.size(); ++h) trace->hops[h].sum.Clear();
+				}
+				merged_hop& hop = trace->hops[nr - 1];
+				if (hop.addr.empty()) {
+					hop.addr = fields[2];
+					hop.name = fields[3];
+				}
+				else if (hop.addr != fields[2])
+					hop.addr = "*";
+				hop.sum.Merge(sum);
+			}
+		}
+		fclose(fp);
+	}
+	if (!files) {
+		AfxMessageBox("No statistics file could be read.");
+		return;
+	}
+
+	CFileDialog out(FALSE, _T("wmtrstats"), NULL, OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT | OFN_EXPLORER, STATS_FILTER, this);
+	if (out.DoModal() != IDOK) return;
+	FILE* fp = fopen(out.GetPathName(), "wt");
+	if (fp == NULL) {
+		AfxMessageBox("Unable to save the statistics.");
+		return;
+	}
+	fprintf(fp, "%s\n", STATS_MAGIC);
+	for (size_t t = 0; t < traces.size(); ++t) {
+		fprintf(fp, "trace\t%s\n", traces[t].label.c_str());
+		for (size_t h = 0; h < traces[t].hops.size(); ++h) {
+			const merged_hop& hop = traces[t].hops[h];
+			fprintf(fp, "hop\t%d\t%s\t%s\t%s\n", (int)h + 1, hop.addr.empty() ? "-" : hop.addr.c_str(),
+				hop.name.empty() ? "-" : hop.name.c_str(), hop.sum.Serialize().c_str());
+		}
+	}
+	fclose(fp);
+
+	char buf[100];
+	sprintf(buf, "Merged %d statistics files.", files);
+	statusBar.SetPaneText(0, buf);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::ShowHostProperties
+//
+//*****************************************************************************
+void WinMTRDialog::ShowHostProperties(CListCtrl& list, WinMTRNet* net)
+{
 	if (state == TRACING || state == IDLE || state == STOPPING) {
 
-		POSITION pos = m_listMTR.GetFirstSelectedItemPosition();
+		POSITION pos = list.GetFirstSelectedItemPosition();
 		if (pos != NULL) {
-			int nItem = m_listMTR.GetNextSelectedItem(pos);
+			int nItem = list.GetNextSelectedItem(pos);
+			std::vector<s_hopsnapshot> hops;
+			if (nItem >= net->GetSnapshot(hops)) return;
+			const s_hopsnapshot& hop = hops[nItem];
 			WinMTRProperties wmtrprop;
 
-			union { sockaddr* addr; sockaddr_in* addr4; sockaddr_in6* addr6; };
-			addr = wmtrnet->GetAddr(nItem);
-			if (!(addr4->sin_family == AF_INET && addr4->sin_addr.s_addr) && !(addr6->sin6_family == AF_INET6 && (addr6->sin6_addr.u.Word[0] | addr6->sin6_addr.u.Word[1] | addr6->sin6_addr.u.Word[2] | addr6->sin6_addr.u.Word[3] | addr6->sin6_addr.u.Word[4] | addr6->sin6_addr.u.Word[5] | addr6->sin6_addr.u.Word[6] | addr6->sin6_addr.u.Word[7]))) {
+			if (!hop.addr_id) {
 				strcpy(wmtrprop.host, "");
 				strcpy(wmtrprop.ip, "");
-				wmtrnet->GetName(nItem, wmtrprop.comment);
+				strcpy(wmtrprop.comment, hop.name);
 			}
 			else {
-				wmtrnet->GetName(nItem, wmtrprop.host);
-				if (getnameinfo(addr, sizeof(sockaddr_in6), wmtrprop.ip, 40, NULL, 0, NI_NUMERICHOST)) {
+				strcpy(wmtrprop.host, hop.name);
+				if (getnameinfo((const sockaddr*)&hop.addr6, sizeof(sockaddr_in6), wmtrprop.ip, 40, NULL, 0, NI_NUMERICHOST)) {
 					*wmtrprop.ip = '\0';
 				}
 				strcpy(wmtrprop.comment, "Host alive.");
 			}
 
-			wmtrprop.ping_avrg = (float)wmtrnet->GetAvg(nItem);
-			wmtrprop.ping_last = (float)wmtrnet->GetLast(nItem);
-			wmtrprop.ping_best = (float)wmtrnet->GetBest(nItem);
-			wmtrprop.ping_worst = (float)wmtrnet->GetWorst(nItem);
-
-			wmtrprop.pck_loss = wmtrnet->GetPercent(nItem);
-			wmtrprop.pck_recv = wmtrnet->GetReturned(nItem);
-			wmtrprop.pck_sent = wmtrnet->GetXmit(nItem);
+			wmtrprop.ping_avrg = (float)hop.avg;
+			wmtrprop.ping_last = (float)hop.last;
+			wmtrprop.ping_best = (float)hop.best;
+			wmtrprop.ping_worst = (float)hop.worst;
+
+			wmtrprop.pck_loss = hop.percent;
+			wmtrprop.pck_recv = hop.returned;
+			wmtrprop.pck_sent = hop.xmit;
+			wmtrprop.net = net;
+			wmtrprop.hop = nItem;
+
+			if (hop.loss.nr_bursts) {
+				char line[128];
+				sprintf(line, "%llu loss runs, longest %d, mean %.1f. Run lengths:", hop.loss.nr_bursts, hop.loss.longest, hop.loss.mean_burst);
+				wmtrprop.losspattern = line;
+				for (int b = 0; b < BURST_BUCKETS; b++) {
+					sprintf(line, b < BURST_BUCKETS - 1 ? " %d: %llu" : " %d+: %llu", b + 1, hop.loss.bursts[b]);
+					wmtrprop.losspattern += line;
+				}
+				sprintf(line, "\r\nGilbert-Elliott: p = %.3f, r = %.3f, h = %.2f (%s)", hop.loss.ge_p, hop.loss.ge_r, hop.loss.ge_h,
+					hop.loss.ge_p + hop.loss.ge_r > 0.8 ? "random loss" : "bursty loss");
+				wmtrprop.losspattern += line;
+			}
+			else
+				wmtrprop.losspattern = "No loss.";
+
+			std::vector<s_sample> samples;
+			ULONGLONG now = GetTickCount64();
+			char line[NI_MAXHOST + 40], from[NI_MAXHOST];
+			for (int i = net->GetSamples(nItem, samples) - 1; i >= 0; i--) {
+				const s_sample& sample = samples[i];
+				if (!sample.addr_id || getnameinfo((const sockaddr*)&sample.addr6, sizeof(sockaddr_in6), from, NI_MAXHOST, NULL, 0, NI_NUMERICHOST))
+					strcpy(from, "-");
+				if (sample.rtt < 0)
+					sprintf(line, "-%4llu s   lost     %s\r\n", (now - sample.time) / 1000, from);
+				else
+					sprintf(line, "-%4llu s %4d ms    %s\r\n", (now - sample.time) / 1000, sample.rtt, from);
+				wmtrprop.recent += line;
+			}
 
 			wmtrprop.DoModal();
 		}
@@ -622,6 +1157,17 @@ void WinMTRDialog::SetInterval(float i)
 	interval = i;
 }
 
+//*****************************************************************************
+// WinMTRDialog::SetMinInterval
+//
+// Fastest ping interval of a hop in trouble; 0, or not below the interval,
+// keeps every hop at the interval
+//*****************************************************************************
+void WinMTRDialog::SetMinInterval(float i)
+{
+	minInterval = i < 0 ? 0 : i;
+}
+
 //*****************************************************************************
 // WinMTRDialog::SetUseDNS
 //
@@ -631,6 +1177,79 @@ void WinMTRDialog::SetUseDNS(BOOL udns)
 	useDNS = udns;
 }
 
+//*****************************************************************************
+// WinMTRDialog::SetUseTimestamp
+//
+//*****************************************************************************
+void WinMTRDialog::SetUseTimestamp(BOOL uts)
+{
+	useTimestamp = uts;
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetUseDualStack
+//
+//*****************************************************************************
+void WinMTRDialog::SetUseDualStack(BOOL uds)
+{
+	useDualStack = uds;
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetFanout
+//
+//*****************************************************************************
+void WinMTRDialog::SetFanout(int fo)
+{
+	fanout = fo < 0 ? 0 : fo > MAX_FANOUT ? MAX_FANOUT : fo;
+}
+
+//*****************************************************************************
+// WinMTRDialog::SetDscpClasses
+//
+// Takes a comma separated list of DSCP classes, either numbers (0-63) or
+// names (BE, EF, CS0-CS7, AF11-AF43). Unknown entries are dropped.
+//*****************************************************************************
+void WinMTRDialog::SetDscpClasses(const char* list)
+{
+	dscpList = list;
+	dscpClasses.clear();
+	std::istringstream iss(dscpList);
+	std::string token;
+	while (std::getline(iss, token, ',') && dscpClasses.size() < MAX_DSCP_CLASSES) {
+		token.erase(0, token.find_first_not_of(" \t"));
+		token.erase(token.find_last_not_of(" \t") + 1);
+		const char* t = token.c_str();
+		int dscp = -1;
+		if (isdigit((unsigned char)*t))
+			dscp = atoi(t);
+		else if (!_stricmp(t, "BE") || !_stricmp(t, "DF"))
+			dscp = 0;
+		else if (!_stricmp(t, "EF"))
+			dscp = 46;
+		else if (!_strnicmp(t, "CS", 2) && t[2] >= '0' && t[2] <= '7' && !t[3])
+			dscp = (t[2] - '0') << 3;
+		else if (!_strnicmp(t, "AF", 2) && t[2] >= '1' && t[2] <= '4' && t[3] >= '1' && t[3] <= '3' && !t[4])
+			dscp = ((t[2] - '0') << 3) | ((t[3] - '0') << 1);
+		if (dscp < 0 || dscp > 63) continue;
+		if (std::find(dscpClasses.begin(), dscpClasses.end(), dscp) == dscpClasses.end())
+			dscpClasses.push_back(dscp);
+	}
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::SetAlertRules
+//
+// See WinMTRAlert.h for the syntax; a malformed list disables alerting
+//*****************************************************************************
+void WinMTRDialog::SetAlertRules(const char* spec)
+{
+	alertSpec = spec;
+	if (!ParseAlertRules(spec, alertRules))
+		TRACE_MSG("Invalid alert rules: " << spec);
+}
+
 
 
 
@@ -657,6 +1276,7 @@ void WinMTRDialog::OnRestart()
 			return;
 		}
 		m_listMTR.DeleteAllItems();
+		m_listMTR2.DeleteAllItems();
 
 		HKEY hKey; DWORD tmp_dword;
 		if (RegCreateKeyEx(HKEY_CURRENT_USER, "Software\\WinMTR\\Config", 0, NULL, 0, KEY_ALL_ACCESS, NULL, &hKey, NULL) == ERROR_SUCCESS) {
@@ -694,13 +1314,21 @@ void WinMTRDialog::OnRestart()
 //*****************************************************************************
 void WinMTRDialog::OnOptions()
 {
-	WinMTROptions optDlg(interval, pingsize, maxLRU, useDNS);
+	if (replayJob) {// the replay reads the interval
+		statusBar.SetPaneText(0, "Options are locked until the replay ends.");
+		return;
+	}
+	WinMTROptions optDlg(interval, pingsize, maxLRU, useDNS, useTimestamp, useDualStack, fanout, dscpList.c_str());
 	if (IDOK == optDlg.DoModal()) {
 
 		pingsize = (WORD)optDlg.GetPingSize();
 		interval = optDlg.GetInterval();
 		maxLRU = optDlg.GetMaxLRU();
 		useDNS = optDlg.GetUseDNS();
+		useTimestamp = optDlg.GetUseTimestamp();
+		useDualStack = optDlg.GetUseDualStack();
+		SetFanout(optDlg.GetFanout());
+		SetDscpClasses(optDlg.GetDscp());
 
 		HKEY hKey;
 		DWORD tmp_dword;
@@ -712,6 +1340,13 @@ void WinMTRDialog::OnOptions()
 			RegSetValueEx(hKey, "MaxLRU", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
 			tmp_dword = useDNS ? 1 : 0;
 			RegSetValueEx(hKey, "UseDNS", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
+			tmp_dword = useTimestamp ? 1 : 0;
+			RegSetValueEx(hKey, "UseTimestamp", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
+			tmp_dword = useDualStack ? 1 : 0;
+			RegSetValueEx(hKey, "DualStack", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
+			tmp_dword = fanout;
+			RegSetValueEx(hKey, "FanOut", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
+			RegSetValueEx(hKey, "DscpClasses", 0, REG_SZ, (const unsigned char*)dscpList.c_str(), (DWORD)dscpList.size() + 1);
 			tmp_dword = (DWORD)(interval * 1000);
 			RegSetValueEx(hKey, "Interval", 0, REG_DWORD, (const unsigned char*)&tmp_dword, sizeof(DWORD));
 			RegCloseKey(hKey);
@@ -734,106 +1369,158 @@ void WinMTRDialog::OnOptions()
 
 
 //*****************************************************************************
-// WinMTRDialog::OnCTTC
-//
+// WinMTRDialog::ReportText
 //
+// Statistics of every trace as text table
 //*****************************************************************************
-void WinMTRDialog::OnCTTC()
+std::string WinMTRDialog::ReportText()
 {
-	char buf[255], t_buf[1000], f_buf[255 * 100];
-
-	int nh = wmtrnet->GetMax();
+	char buf[255], t_buf[1000];
+	std::string report;
+
+	for (size_t t = 0; t < wmtrnets.size(); ++t) {
+		WinMTRNet* net = wmtrnets[t];
+		std::vector<s_hopsnapshot> hops;
+		int nh = net->GetSnapshot(hops);
+		for (int i = 0; i < nh; i++) ApplyWindow(hops[i]);
+
+		report += "|---------------------------------------------------------------------------------------------------------------------------------------------------------------|\r\n";
+		report += "|                                                                        WinMTR statistics                                                                      |\r\n";
+		if (wmtrnets.size() > 1) {
+			sprintf(t_buf, "|  %-157.157s|\r\n", net->label);
+			report += t_buf;
+		}
+		if (viewWindow) {
+			sprintf(t_buf, "Loss, Sent, Recv and Avrg over the last %s", WINDOW_NAMES[viewWindow]);
+			sprintf(buf, "|  %-157.157s|\r\n", t_buf);
+			report += buf;
+		}
+		report += "|                       Host              -   %  | Sent | Recv | Best | Avrg | Wrst | Last | P50  | P90  | P95  | P99  | StDev  | Jitter |        Recent        |\r\n";
+		report += "|------------------------------------------------|------|------|------|------|------|------|------|------|------|------|--------|--------|----------------------|\r\n";
 
-	strcpy(f_buf, "|------------------------------------------------------------------------------------------|\r\n");
-	sprintf(t_buf, "|                                      WinMTR statistics                                   |\r\n");
-	strcat(f_buf, t_buf);
-	sprintf(t_buf, "|                       Host              -   %%  | Sent | Recv | Best | Avrg | Wrst | Last |\r\n");
-	strcat(f_buf, t_buf);
-	sprintf(t_buf, "|------------------------------------------------|------|------|------|------|------|------|\r\n");
-	strcat(f_buf, t_buf);
+		for (int i = 0; i < nh; i++) {
+			strcpy(buf, hops[i].name);
+			if (strcmp(buf, "") == 0) strcpy(buf, "No response from host");
 
-	for (int i = 0; i < nh; i++) {
-		wmtrnet->GetName(i, buf);
-		if (strcmp(buf, "") == 0) strcpy(buf, "No response from host");
+			sprintf(t_buf, "|%40s - %4d | %4lld | %4lld | %4d | %4d | %4d | %4d | %4d | %4d | %4d | %4d | %6.1f | %6.1f | %-20.20s |\r\n",
+				buf, hops[i].percent,
+				hops[i].xmit, hops[i].returned, hops[i].best,
+				hops[i].avg, hops[i].worst, hops[i].last,
+				hops[i].p50, hops[i].p90, hops[i].p95, hops[i].p99,
+				hops[i].stddev, hops[i].jitter, Sparkline(net, i).c_str());
+			report += t_buf;
+		}
 
-		sprintf(t_buf, "|%40s - %4d | %4d | %4d | %4d | %4d | %4d | %4d |\r\n",
-			buf, wmtrnet->GetPercent(i),
-			wmtrnet->GetXmit(i), wmtrnet->GetReturned(i), wmtrnet->GetBest(i),
-			wmtrnet->GetAvg(i), wmtrnet->GetWorst(i), wmtrnet->GetLast(i));
-		strcat(f_buf, t_buf);
+		report += "|________________________________________________|______|______|______|______|______|______|______|______|______|______|________|________|______________________|\r\n";
 	}
 
-	sprintf(t_buf, "|________________________________________________|______|______|______|______|______|______|\r\n");
-	strcat(f_buf, t_buf);
+	if (wmtrnets.size() > 1 && m_comboTrace.IsWindowVisible()) {
+		std::vector<size_t> order = RankTraces();
+		report += "|------------------------------------------------------------------------------------------|\r\n";
+		report += "|                                 Ranking by loss and latency                              |\r\n";
+		report += "|  #  |                 Address                  |  Hops  |  Loss %  |  Avrg  |  Wrst  |   |\r\n";
+		report += "|-----|------------------------------------------|--------|----------|--------|--------|---|\r\n";
+		for (size_t r = 0; r < order.size(); ++r) {
+			WinMTRNet* net = wmtrnets[order[r]];
+			s_hopsnapshot dest;
+			int nh = net->GetDestination(&dest);
+			sprintf(t_buf, "| %3d | %40.40s | %6d | %8d | %6d | %6d |   |\r\n", (int)r + 1, net->label, nh,
+				dest.percent, dest.avg, dest.worst);
+			report += t_buf;
+		}
+		report += "|_____|__________________________________________|________|__________|________|________|___|\r\n";
+	}
 
 	CString cs_tmp((LPCSTR)IDS_STRING_SB_NAME);
-	strcat(f_buf, "   ");
-	strcat(f_buf, (LPCTSTR)cs_tmp);
-
-	CString source(f_buf);
-
-	HGLOBAL clipbuffer;
-	char* buffer;
-
-	OpenClipboard();
-	EmptyClipboard();
-
-	clipbuffer = GlobalAlloc(GMEM_DDESHARE, source.GetLength() + 1);
-	buffer = (char*)GlobalLock(clipbuffer);
-	strcpy(buffer, LPCSTR(source));
-	GlobalUnlock(clipbuffer);
-
-	SetClipboardData(CF_TEXT, clipbuffer);
-	CloseClipboard();
+	report += "   ";
+	report += (LPCTSTR)cs_tmp;
+	return report;
 }
 
 
 //*****************************************************************************
-// WinMTRDialog::OnCHTC
-//
+// WinMTRDialog::ReportHtml
 //
+// Statistics of every trace as HTML table
 //*****************************************************************************
-void WinMTRDialog::OnCHTC()
+std::string WinMTRDialog::ReportHtml()
 {
-	char buf[255], t_buf[1000], f_buf[255 * 100];
+	char buf[255], t_buf[1000];
+	std::string report;
 
-	int nh = wmtrnet->GetMax();
+	report += "<html><head><title>WinMTR Statistics</title></head><body bgcolor=\"white\">\r\n";
+	report += "<center><h2>WinMTR statistics</h2></center>\r\n";
 
-	strcpy(f_buf, "<html><head><title>WinMTR Statistics</title></head><body bgcolor=\"white\">\r\n");
-	sprintf(t_buf, "<center><h2>WinMTR statistics</h2></center>\r\n");
-	strcat(f_buf, t_buf);
+	for (size_t t = 0; t < wmtrnets.size(); ++t) {
+		WinMTRNet* net = wmtrnets[t];
+		std::vector<s_hopsnapshot> hops;
+		int nh = net->GetSnapshot(hops);
+		for (int i = 0; i < nh; i++) ApplyWindow(hops[i]);
 
-	sprintf(t_buf, "<p align=\"center\"> <table border=\"1\" align=\"center\">\r\n");
-	strcat(f_buf, t_buf);
+		if (wmtrnets.size() > 1) {
+			sprintf(t_buf, "<center><h3>%s</h3></center>\r\n", net->label);
+			report += t_buf;
+		}
+		if (viewWindow) {
+			sprintf(t_buf, "<center>Loss, Sent, Recv and Avrg over the last %s</center>\r\n", WINDOW_NAMES[viewWindow]);
+			report += t_buf;
+		}
+		report += "<p align=\"center\"> <table border=\"1\" align=\"center\">\r\n";
+		report += "<tr><td>Host</td> <td>%</td> <td>Sent</td> <td>Recv</td> <td>Best</td> <td>Avrg</td> <td>Wrst</td> <td>Last</td> <td>P50</td> <td>P90</td> <td>P95</td> <td>P99</td> <td>StDev</td> <td>Jitter</td> <td>Recent</td></tr>\r\n";
+
+		for (int i = 0; i < nh; i++) {
+			strcpy(buf, hops[i].name);
+			if (strcmp(buf, "") == 0) strcpy(buf, "No response from host");
 
-	sprintf(t_buf, "<tr><td>Host</td> <td>%%</td> <td>Sent</td> <td>Recv</td> <td>Best</td> <td>Avrg</td> <td>Wrst</td> <td>Last</td></tr>\r\n");
-	strcat(f_buf, t_buf);
+			sprintf(t_buf, "<tr><td>%s</td> <td>%4d</td> <td>%4lld</td> <td>%4lld</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%.1f</td> <td>%.1f</td> <td><tt>%s</tt></td></tr>\r\n",
+				buf, hops[i].percent,
+				hops[i].xmit, hops[i].returned, hops[i].best,
+				hops[i].avg, hops[i].worst, hops[i].last,
+				hops[i].p50, hops[i].p90, hops[i].p95, hops[i].p99,
+				hops[i].stddev, hops[i].jitter, Sparkline(net, i).c_str());
+			report += t_buf;
+		}
 
-	for (int i = 0; i < nh; i++) {
-		wmtrnet->GetName(i, buf);
-		if (strcmp(buf, "") == 0) strcpy(buf, "No response from host");
+		report += "</table>\r\n";
+	}
 
-		sprintf(t_buf, "<tr><td>%s</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td></tr>\r\n",
-			buf, wmtrnet->GetPercent(i),
-			wmtrnet->GetXmit(i), wmtrnet->GetReturned(i), wmtrnet->GetBest(i),
-			wmtrnet->GetAvg(i), wmtrnet->GetWorst(i), wmtrnet->GetLast(i));
-		strcat(f_buf, t_buf);
+	if (wmtrnets.size() > 1 && m_comboTrace.IsWindowVisible()) {
+		std::vector<size_t> order = RankTraces();
+		report += "<center><h3>Ranking by loss and latency</h3></center>\r\n";
+		report += "<p align=\"center\"> <table border=\"1\" align=\"center\">\r\n";
+		report += "<tr><td>#</td> <td>Address</td> <td>Hops</td> <td>%</td> <td>Avrg</td> <td>Wrst</td></tr>\r\n";
+		for (size_t r = 0; r < order.size(); ++r) {
+			WinMTRNet* net = wmtrnets[order[r]];
+			s_hopsnapshot dest;
+			int nh = net->GetDestination(&dest);
+			sprintf(t_buf, "<tr><td>%d</td> <td>%s</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td></tr>\r\n", (int)r + 1, net->label, nh,
+				dest.percent, dest.avg, dest.worst);
+			report += t_buf;
+		}
+		report += "</table>\r\n";
 	}
 
-	sprintf(t_buf, "</table></body></html>\r\n");
-	strcat(f_buf, t_buf);
+	report += "</body></html>\r\n";
+	return report;
+}
 
-	CString source(f_buf);
 
+//*****************************************************************************
+// WinMTRDialog::CopyToClipboard
+//
+//
+//*****************************************************************************
+void WinMTRDialog::CopyToClipboard(const std::string& source)
+{
 	HGLOBAL clipbuffer;
 	char* buffer;
 
 	OpenClipboard();
 	EmptyClipboard();
 
-	clipbuffer = GlobalAlloc(GMEM_DDESHARE, source.GetLength() + 1);
+	clipbuffer = GlobalAlloc(GMEM_DDESHARE, source.length() + 1);
 	buffer = (char*)GlobalLock(clipbuffer);
-	strcpy(buffer, LPCSTR(source));
+	strcpy(buffer, source.c_str());
 	GlobalUnlock(clipbuffer);
 
 	SetClipboardData(CF_TEXT, clipbuffer);
@@ -841,6 +1528,28 @@ void WinMTRDialog::OnCHTC()
 }
 
 
+//*****************************************************************************
+// WinMTRDialog::OnCTTC
+//
+//
+//*****************************************************************************
+void WinMTRDialog::OnCTTC()
+{
+	CopyToClipboard(ReportText());
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::OnCHTC
+//
+//
+//*****************************************************************************
+void WinMTRDialog::OnCHTC()
+{
+	CopyToClipboard(ReportHtml());
+}
+
+
 //*****************************************************************************
 // WinMTRDialog::OnEXPT
 //
@@ -857,41 +1566,9 @@ void WinMTRDialog::OnEXPT()
 		szFilter,
 		this);
 	if (dlg.DoModal() == IDOK) {
-
-		char buf[255], t_buf[1000], f_buf[255 * 100];
-
-		int nh = wmtrnet->GetMax();
-
-		strcpy(f_buf, "|------------------------------------------------------------------------------------------|\r\n");
-		sprintf(t_buf, "|                                      WinMTR statistics                                   |\r\n");
-		strcat(f_buf, t_buf);
-		sprintf(t_buf, "|                       Host              -   %%  | Sent | Recv | Best | Avrg | Wrst | Last |\r\n");
-		strcat(f_buf, t_buf);
-		sprintf(t_buf, "|------------------------------------------------|------|------|------|------|------|------|\r\n");
-		strcat(f_buf, t_buf);
-
-		for (int i = 0; i < nh; i++) {
-			wmtrnet->GetName(i, buf);
-			if (strcmp(buf, "") == 0) strcpy(buf, "No response from host");
-
-			sprintf(t_buf, "|%40s - %4d | %4d | %4d | %4d | %4d | %4d | %4d |\r\n",
-				buf, wmtrnet->GetPercent(i),
-				wmtrnet->GetXmit(i), wmtrnet->GetReturned(i), wmtrnet->GetBest(i),
-				wmtrnet->GetAvg(i), wmtrnet->GetWorst(i), wmtrnet->GetLast(i));
-			strcat(f_buf, t_buf);
-		}
-
-		sprintf(t_buf, "|________________________________________________|______|______|______|______|______|______|\r\n");
-		strcat(f_buf, t_buf);
-
-
-		CString cs_tmp((LPCSTR)IDS_STRING_SB_NAME);
-		strcat(f_buf, "   ");
-		strcat(f_buf, (LPCTSTR)cs_tmp);
-
 		FILE* fp = fopen(dlg.GetPathName(), "wt");
 		if (fp != NULL) {
-			fprintf(fp, "%s", f_buf);
+			fprintf(fp, "%s", ReportText().c_str());
 			fclose(fp);
 		}
 	}
@@ -915,43 +1592,12 @@ void WinMTRDialog::OnEXPH()
 		this);
 
 	if (dlg.DoModal() == IDOK) {
-
-		char buf[255], t_buf[1000], f_buf[255 * 100];
-
-		int nh = wmtrnet->GetMax();
-
-		strcpy(f_buf, "<html><head><title>WinMTR Statistics</title></head><body bgcolor=\"white\">\r\n");
-		sprintf(t_buf, "<center><h2>WinMTR statistics</h2></center>\r\n");
-		strcat(f_buf, t_buf);
-
-		sprintf(t_buf, "<p align=\"center\"> <table border=\"1\" align=\"center\">\r\n");
-		strcat(f_buf, t_buf);
-
-		sprintf(t_buf, "<tr><td>Host</td> <td>%%</td> <td>Sent</td> <td>Recv</td> <td>Best</td> <td>Avrg</td> <td>Wrst</td> <td>Last</td></tr>\r\n");
-		strcat(f_buf, t_buf);
-
-		for (int i = 0; i < nh; i++) {
-			wmtrnet->GetName(i, buf);
-			if (strcmp(buf, "") == 0) strcpy(buf, "No response from host");
-
-			sprintf(t_buf, "<tr><td>%s</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td> <td>%4d</td></tr>\r\n",
-				buf, wmtrnet->GetPercent(i),
-				wmtrnet->GetXmit(i), wmtrnet->GetReturned(i), wmtrnet->GetBest(i),
-				wmtrnet->GetAvg(i), wmtrnet->GetWorst(i), wmtrnet->GetLast(i));
-			strcat(f_buf, t_buf);
-		}
-
-		sprintf(t_buf, "</table></body></html>\r\n");
-		strcat(f_buf, t_buf);
-
 		FILE* fp = fopen(dlg.GetPathName(), "wt");
 		if (fp != NULL) {
-			fprintf(fp, "%s", f_buf);
+			fprintf(fp, "%s", ReportHtml().c_str());
 			fclose(fp);
 		}
 	}
-
-
 }
 
 
@@ -980,66 +1626,145 @@ std::string WinMTRDialog::getCurrentUTCTimeISO8601() {
 //*****************************************************************************
 int WinMTRDialog::DisplayRedraw()
 {
+	for (size_t t = 0; t < wmtrnets.size(); ++t) {
+		CListCtrl* list = NULL;// traces not on screen still get logged
+		if (t == viewTrace) list = &m_listMTR;
+		else if (t == 1 && m_listMTR2.IsWindowVisible()) list = &m_listMTR2;
+		DisplayTrace(list, wmtrnets[t], true);
+	}
+	LogEvents();
 
+	if (m_bTrayIconVisible == true)
+	{
+		if (IsWindowVisible()) {
+			MinimizeToTray();
+			m_bTrayIconVisible = false;
+		}
+	}
+	return 0;
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::DisplayTrace
+//
+// Fills the list (if any) with the hops of one trace and logs them, one
+// row per trace named by its label: target address and DSCP class
+//*****************************************************************************
+void WinMTRDialog::DisplayTrace(CListCtrl* list, WinMTRNet* net, bool log)
+{
 	data	savedata;
 	std::list<data>		datalistitem;
 
 
 	char buf[255], nr_crt[255];
-	int nh = wmtrnet->GetMax();
-	while (m_listMTR.GetItemCount() > nh) m_listMTR.DeleteItem(m_listMTR.GetItemCount() - 1);
+	std::vector<s_hopsnapshot> hops;
+	int nh = net->GetSnapshot(hops);
+	if (list)
+		while (list->GetItemCount() > nh) list->DeleteItem(list->GetItemCount() - 1);
 
 	for (int i = 0; i < nh; ++i) {
+		s_hopsnapshot& hop = hops[i];
+		ApplyWindow(hop);
 
-		wmtrnet->GetName(i, buf);
+		strcpy(buf, hop.name);
 		if (!*buf) strcpy(buf, "No response from host");
 
 		sprintf(nr_crt, "%d", i + 1);
-		if (m_listMTR.GetItemCount() <= i)
-			m_listMTR.InsertItem(i, buf);
-		else
-			m_listMTR.SetItem(i, 0, LVIF_TEXT, buf, 0, 0, 0, 0);
+		if (list) {
+			if (list->GetItemCount() <= i)
+				list->InsertItem(i, buf);
+			else
+				list->SetItem(i, 0, LVIF_TEXT, buf, 0, 0, 0, 0);
+		}
 
 		savedata.host = buf;
-
-		m_listMTR.SetItem(i, 1, LVIF_TEXT, nr_crt, 0, 0, 0, 0);
-
 		savedata.nr_crt = nr_crt;
 
-		sprintf(buf, "%d", wmtrnet->GetPercent(i));
-		m_listMTR.SetItem(i, 2, LVIF_TEXT, buf, 0, 0, 0, 0);
-
+		sprintf(buf, "%d", hop.percent);
 		savedata.Percent = buf;
 
-		sprintf(buf, "%d", wmtrnet->GetXmit(i));
-		m_listMTR.SetItem(i, 3, LVIF_TEXT, buf, 0, 0, 0, 0);
-
+		sprintf(buf, "%lld", hop.xmit);
 		savedata.Xmit = buf;
 
-		sprintf(buf, "%d", wmtrnet->GetReturned(i));
-		m_listMTR.SetItem(i, 4, LVIF_TEXT, buf, 0, 0, 0, 0);
-
+		sprintf(buf, "%lld", hop.returned);
 		savedata.Returned = buf;
 
-		sprintf(buf, "%d", wmtrnet->GetBest(i));
-		m_listMTR.SetItem(i, 5, LVIF_TEXT, buf, 0, 0, 0, 0);
-
+		sprintf(buf, "%d", hop.best);
 		savedata.Best = buf;
 
-		sprintf(buf, "%d", wmtrnet->GetAvg(i));
-		m_listMTR.SetItem(i, 6, LVIF_TEXT, buf, 0, 0, 0, 0);
-
+		sprintf(buf, "%d", hop.avg);
 		savedata.Avg = buf;
 
-		sprintf(buf, "%d", wmtrnet->GetWorst(i));
-		m_listMTR.SetItem(i, 7, LVIF_TEXT, buf, 0, 0, 0, 0);
-
+		sprintf(buf, "%d", hop.worst);
 		savedata.Worst = buf;
 
-		sprintf(buf, "%d", wmtrnet->GetLast(i));
-		m_listMTR.SetItem(i, 8, LVIF_TEXT, buf, 0, 0, 0, 0);
-
+		sprintf(buf, "%d", hop.last);
 		savedata.last = buf;
+
+		sprintf(buf, "%d", hop.p50);
+		savedata.P50 = buf;
+		sprintf(buf, "%d", hop.p90);
+		savedata.P90 = buf;
+		sprintf(buf, "%d", hop.p95);
+		savedata.P95 = buf;
+		sprintf(buf, "%d", hop.p99);
+		savedata.P99 = buf;
+
+		sprintf(buf, "%.1f", hop.stddev);
+		savedata.StDev = buf;
+		sprintf(buf, "%.1f", hop.jitter);
+		savedata.Jitter = buf;
+
+		if (hop.oneway) {
+			sprintf(buf, "%d", hop.fwd);
+			savedata.Fwd = buf;
+			sprintf(buf, "%d", hop.ret);
+			savedata.Rev = buf;
+		}
+		else {
+			savedata.Fwd.clear();
+			savedata.Rev.clear();
+		}
+
+		if (hop.rhops) sprintf(buf, hop.asymmetric ? "%d*" : "%d", hop.rhops);
+		else *buf = '\0';
+		savedata.RPath = buf;
+
+		if (hop.loss.nr_bursts) sprintf(buf, "%.1f", hop.loss.mean_burst);
+		else *buf = '\0';
+		savedata.Burst = buf;
+
+		if (hop.deviation != INT_MIN) sprintf(buf, hop.abnormal ? "%.1f!" : "%.1f", hop.deviation / 10.0);
+		else *buf = '\0';
+		savedata.Dev = buf;
+
+		savedata.Recent = Sparkline(net, i);
+
+		if (list) {
+			list->SetItem(i, 1, LVIF_TEXT, savedata.nr_crt.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 2, LVIF_TEXT, savedata.Percent.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 3, LVIF_TEXT, savedata.Xmit.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 4, LVIF_TEXT, savedata.Returned.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 5, LVIF_TEXT, savedata.Best.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 6, LVIF_TEXT, savedata.Avg.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 7, LVIF_TEXT, savedata.Worst.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 8, LVIF_TEXT, savedata.last.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 9, LVIF_TEXT, savedata.P50.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 10, LVIF_TEXT, savedata.P90.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 11, LVIF_TEXT, savedata.P95.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 12, LVIF_TEXT, savedata.P99.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 13, LVIF_TEXT, savedata.StDev.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 14, LVIF_TEXT, savedata.Jitter.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 15, LVIF_TEXT, savedata.Fwd.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 16, LVIF_TEXT, savedata.Rev.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 17, LVIF_TEXT, savedata.RPath.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 18, LVIF_TEXT, savedata.Burst.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 19, LVIF_TEXT, savedata.Dev.c_str(), 0, 0, 0, 0);
+			list->SetItem(i, 20, LVIF_TEXT, savedata.Recent.c_str(), 0, 0, 0, 0);
+			list->SetItemData(i, hop.abnormal);
+		}
+
 		savedata.date = getCurrentUTCTimeISO8601();
 
 
@@ -1047,6 +1772,7 @@ int WinMTRDialog::DisplayRedraw()
 		datalistitem.push_back(savedata);
 
 	}
+	if (!log) return;
 
 	if (datalistitem.size() < MAXHOOP)
 	{
@@ -1062,9 +1788,9 @@ int WinMTRDialog::DisplayRedraw()
 	{
 		if (&item == &datalistitem.front())
 		{
-			oss << item.date << FIELD_SEPARATOR << OS::utility::ComputerName() << FIELD_SEPARATOR << OS::utility::UserName() << FIELD_SEPARATOR;
+			oss << item.date << FIELD_SEPARATOR << OS::utility::ComputerName() << FIELD_SEPARATOR << OS::utility::UserName() << FIELD_SEPARATOR << WINDOW_NAMES[viewWindow] << FIELD_SEPARATOR << net->label << FIELD_SEPARATOR;
 		}
-		oss << item.host << FIELD_SEPARATOR << item.nr_crt << FIELD_SEPARATOR << item.Percent << FIELD_SEPARATOR << item.Xmit << FIELD_SEPARATOR << item.Returned << FIELD_SEPARATOR << item.Best << FIELD_SEPARATOR << item.Avg << FIELD_SEPARATOR << item.Worst << FIELD_SEPARATOR << item.last << FIELD_SEPARATOR;
+		oss << item.host << FIELD_SEPARATOR << item.nr_crt << FIELD_SEPARATOR << item.Percent << FIELD_SEPARATOR << item.Xmit << FIELD_SEPARATOR << item.Returned << FIELD_SEPARATOR << item.Best << FIELD_SEPARATOR << item.Avg << FIELD_SEPARATOR << item.Worst << FIELD_SEPARATOR << item.last << FIELD_SEPARATOR << item.P50 << FIELD_SEPARATOR << item.P90 << FIELD_SEPARATOR << item.P95 << FIELD_SEPARATOR << item.P99 << FIELD_SEPARATOR << item.StDev << FIELD_SEPARATOR << item.Jitter << FIELD_SEPARATOR << item.Fwd << FIELD_SEPARATOR << item.Rev << FIELD_SEPARATOR << item.RPath << FIELD_SEPARATOR << item.Burst << FIELD_SEPARATOR << item.Dev << FIELD_SEPARATOR << item.Recent << FIELD_SEPARATOR;
 	}
 	// remove the last character
 	if (!oss.str().empty())
@@ -1072,22 +1798,109 @@ int WinMTRDialog::DisplayRedraw()
 		oss.seekp(-1, std::ios_base::end);
 	}
 	datalist.push_back(oss.str());
+}
 
-	if (m_bTrayIconVisible == true)
-	{
-		if (IsWindowVisible()) {
-			MinimizeToTray();
-			m_bTrayIconVisible = false;
+
+//*****************************************************************************
+// WinMTRDialog::LogEvents
+//
+// Change points detected by the traces go to the event log and the status
+// bar. Loss events carry the loss rate in "After", latency ones the levels
+// in ms, alert ones the rule number in "Before" and the metric in "After";
+// alerts are also notified, see NotifyAlerts.
+//*****************************************************************************
+void WinMTRDialog::LogEvents()
+{
+	std::vector<s_hopevent> events;
+	char name[255], when[32], buf[NI_MAXHOST + 600];
+
+	for (size_t t = 0; t < wmtrnets.size(); ++t) {
+		WinMTRNet* net = wmtrnets[t];
+		int ne = net->GetEvents(events);
+		for (int e = 0; e < ne; ++e) {
+			const s_hopevent& ev = events[e];
+			net->GetName(ev.hop, name);
+			if (!*name) strcpy(name, "No response from host");
+			strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime(&ev.time));
+
+			std::ostringstream oss;
+			oss << when << FIELD_SEPARATOR << net->label << FIELD_SEPARATOR << ev.hop + 1 << FIELD_SEPARATOR << name << FIELD_SEPARATOR << CHANGE_NAMES[ev.kind] << FIELD_SEPARATOR << ev.before << FIELD_SEPARATOR << ev.after;
+			eventlist.push_back(oss.str());
+
+			if (ev.kind == CHANGE_ALERT_RAISED || ev.kind == CHANGE_ALERT_CLEARED) {
+				if (ev.before >= (int)alertRules.size()) continue;
+				const s_alertrule& rule = alertRules[ev.before];
+				sprintf(buf, "%s %s, hop %d (%s): %s, now %d%s", when, net->label, ev.hop + 1, name,
+					(std::string(CHANGE_NAMES[ev.kind]) + " " + AlertRuleText(rule)).c_str(), ev.after, rule.metric == ALERT_LOSS ? "%" : " ms");
+				pendingAlerts.push_back(buf);
+			}
+			else if (ev.kind == CHANGE_LOSS_ONSET || ev.kind == CHANGE_LOSS_CLEARED || ev.kind == CHANGE_BASELINE_LOSS)
+				sprintf(buf, "%s hop %d (%s): %s, %d%% loss", when, ev.hop + 1, name, CHANGE_NAMES[ev.kind], ev.after);
+			else
+				sprintf(buf, "%s hop %d (%s): %s, %d -> %d ms", when, ev.hop + 1, name, CHANGE_NAMES[ev.kind], ev.before, ev.after);
+			statusBar.SetPaneText(0, buf);
+			TRACE_MSG(buf);
 		}
 	}
-	return 0;
+	NotifyAlerts();
 }
 
 
 //*****************************************************************************
-// WinMTRDialog::InitMTRNet
+// WinMTRDialog::NotifyAlerts
 //
+// Alerts raised / cleared since the last notification, at most once per
+// ALERT_NOTIFY_SECONDS: a balloon on the tray icon (the window flashes when
+// it is not in the tray) and one run of the alert hook for the batch.
+//*****************************************************************************
+void WinMTRDialog::NotifyAlerts()
+{
+	if (pendingAlerts.empty() || GetTickCount64() - lastAlertNotify < ALERT_NOTIFY_SECONDS * 1000ULL) return;
+	lastAlertNotify = GetTickCount64();
+
+	std::string message = pendingAlerts.back();
+	if (pendingAlerts.size() > 1)
+		message += " (+" + std::to_string(pendingAlerts.size() - 1) + " more)";
+	std::vector<std::string> alerts;
+	alerts.swap(pendingAlerts);
+
+	if (!IsWindowVisible()) {
+		m_nid.uFlags = NIF_ICON | NIF_MESSAGE | NIF_TIP | NIF_INFO;
+		m_nid.dwInfoFlags = NIIF_WARNING;
+		_tcscpy_s(m_nid.szInfoTitle, _T("WinMTR alert"));
+		_tcsncpy_s(m_nid.szInfo, message.c_str(), _TRUNCATE);
+		Shell_NotifyIcon(NIM_MODIFY, &m_nid);
+		m_nid.uFlags = NIF_ICON | NIF_MESSAGE | NIF_TIP;
+	}
+	else {
+		FLASHWINFO fi = { sizeof(fi), GetSafeHwnd(), FLASHW_ALL | FLASHW_TIMERNOFG, 3, 0 };
+		FlashWindowEx(&fi);
+	}
+	RunAlertHook(alertHook, message, alerts);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::BaselinePath
+//
+// Baselines live next to the data logs; empty if the folder can't be made
+//*****************************************************************************
+CString WinMTRDialog::BaselinePath()
+{
+	CString exeDir = OS::utility::GetExecutableDirectory();
+	if (exeDir.IsEmpty()) return exeDir;
+	CString folder = exeDir + _T("\\WinMTRData");
+	if (!CreateDirectory(folder, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) return CString();
+	return folder + _T("\\") _T(BASELINE_FILE);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::InitMTRNet
 //
+// Resolves the target once and sets up one trace per address to probe,
+// times the DSCP classes. Dual-stack shows its two traces side by side,
+// with several classes they go to the trace picker like a fan-out.
 //*****************************************************************************
 int WinMTRDialog::InitMTRNet()
 {
@@ -1100,7 +1913,9 @@ int WinMTRDialog::InitMTRNet()
 
 	addrinfo nfofilter = { 0 };
 	addrinfo* anfo;
-	if (wmtrnet->hasIPv6) {
+	bool fanOut = fanout > 1;
+	bool dualStack = useDualStack && wmtrnet->hasIPv6 && !fanOut;
+	if (wmtrnet->hasIPv6 && !dualStack) {
 		switch (useIPv6) {
 		case 0:
 			nfofilter.ai_family = AF_INET; break;
@@ -1117,11 +1932,224 @@ int WinMTRDialog::InitMTRNet()
 		AfxMessageBox("Unable to resolve hostname.");
 		return 0;
 	}
+	ClearTraces();
+	addrinfo* anfo4 = NULL;
+	addrinfo* anfo6 = NULL;
+	for (addrinfo* cur = anfo; cur; cur = cur->ai_next) {
+		if (cur->ai_family == AF_INET && !anfo4) anfo4 = cur;
+		if (cur->ai_family == AF_INET6 && !anfo6) anfo6 = cur;
+	}
+	bool sideBySide = false;
+	bool failed = false;
+	wmtrnet->SetTarget(anfo->ai_addr);//we use first address returned
+	if (fanOut) {// every distinct address, up to fanout of them
+		for (addrinfo* cur = anfo->ai_next; cur && !failed && (int)wmtrnets.size() < fanout; cur = cur->ai_next) {
+			size_t t = 0;
+			while (t < wmtrnets.size() && memcmp(&wmtrnets[t]->target, cur->ai_addr, cur->ai_addrlen)) ++t;
+			if (t == wmtrnets.size()) failed = !AddTrace(cur->ai_addr);
+		}
+	}
+	else if (dualStack && anfo4 && anfo6) {
+		wmtrnet->SetTarget(anfo4->ai_addr);
+		failed = !AddTrace(anfo6->ai_addr);
+		sideBySide = dscpClasses.size() < 2;
+	}
 	freeaddrinfo(anfo);
+
+	if (!failed && !dscpClasses.empty()) {// one trace per address and class, grouped by address
+		std::vector<WinMTRNet*> addrs(wmtrnets);
+		wmtrnets.clear();
+		for (size_t a = 0; a < addrs.size(); ++a) {
+			wmtrnets.push_back(addrs[a]);
+			for (size_t c = 1; c < dscpClasses.size() && !failed; ++c) {
+				WinMTRNet* net = AddTrace(&addrs[a]->target);
+				if (net) net->SetDscp(dscpClasses[c]);
+				else failed = true;
+			}
+			addrs[a]->SetDscp(dscpClasses[0]);
+		}
+	}
+	if (failed) {// the WinMTRNet constructor has told why
+		ClearTraces();
+		statusBar.SetPaneText(0, CString((LPCSTR)IDS_STRING_SB_NAME));
+		AfxMessageBox("Unable to set up every trace of the session.");
+		return 0;
+	}
+
+	viewTrace = 0;
+	m_comboTrace.ResetContent();
+	for (size_t t = 0; t < wmtrnets.size(); ++t)
+		m_comboTrace.AddString(wmtrnets[t]->label);
+	m_comboTrace.SetCurSel(0);
+	m_comboTrace.ShowWindow(wmtrnets.size() > 1 && !sideBySide ? SW_SHOW : SW_HIDE);
+
+	SetListTitle(m_listMTR, wmtrnet);
+	if (sideBySide) SetListTitle(m_listMTR2, wmtrnets[1]);
+	m_listMTR2.DeleteAllItems();
+	m_listMTR2.ShowWindow(sideBySide ? SW_SHOW : SW_HIDE);
+	PositionLists();
 	return 1;
 }
 
 
+//*****************************************************************************
+// WinMTRDialog::SetListTitle
+//
+// Names the trace shown by a list in its first column header
+//*****************************************************************************
+void WinMTRDialog::SetListTitle(CListCtrl& list, WinMTRNet* net)
+{
+	char buf[NI_MAXHOST + 20];
+	LVCOLUMN col = { LVCF_TEXT };
+	sprintf(buf, "%s - %s", MTR_COLS[0], net->label);
+	col.pszText = buf;
+	list.SetColumn(0, &col);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::OnCbnSelchangeComboTrace
+//
+// Switches the main list to another trace of a fan-out session
+//*****************************************************************************
+void WinMTRDialog::OnCbnSelchangeComboTrace()
+{
+	int sel = m_comboTrace.GetCurSel();
+	if (sel < 0 || sel >= (int)wmtrnets.size()) return;
+	viewTrace = sel;
+	m_listMTR.DeleteAllItems();
+	SetListTitle(m_listMTR, wmtrnets[viewTrace]);
+	DisplayTrace(&m_listMTR, wmtrnets[viewTrace], false);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::OnCbnSelchangeComboWindow
+//
+// Switches Loss %, Sent, Recv and Avrg between totals and a sliding window
+//*****************************************************************************
+void WinMTRDialog::OnCbnSelchangeComboWindow()
+{
+	int sel = m_comboWindow.GetCurSel();
+	if (sel < 0 || sel > NR_WINDOWS) return;
+	viewWindow = sel;
+	if (m_listMTR.GetItemCount())// nothing traced yet otherwise
+		DisplayTrace(&m_listMTR, wmtrnets[viewTrace], false);
+	if (m_listMTR2.IsWindowVisible() && m_listMTR2.GetItemCount())
+		DisplayTrace(&m_listMTR2, wmtrnets[1], false);
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::ApplyWindow
+//
+// Puts the counters of the selected sliding window in place of the totals
+//*****************************************************************************
+void WinMTRDialog::ApplyWindow(s_hopsnapshot& hop)
+{
+	if (!viewWindow) return;
+	hop.xmit = hop.window[viewWindow - 1].xmit;
+	hop.returned = hop.window[viewWindow - 1].returned;
+	hop.avg = hop.window[viewWindow - 1].avg;
+	hop.percent = hop.window[viewWindow - 1].percent;
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::Sparkline
+//
+// The last SPARKLINE_SAMPLES probes of a hop, oldest first: one character per
+// probe, '?' when lost, else a bar scaled to the slowest of them
+//*****************************************************************************
+std::string WinMTRDialog::Sparkline(WinMTRNet* net, int at)
+{
+	static const char bars[] = "_.-=+*#";
+	std::vector<s_sample> samples;
+	int n = net->GetSamples(at, samples);
+	int first = n > SPARKLINE_SAMPLES ? n - SPARKLINE_SAMPLES : 0;
+	int max = 0;
+	for (int i = first; i < n; i++)
+		if (samples[i].rtt > max) max = samples[i].rtt;
+
+	std::string line;
+	for (int i = first; i < n; i++) {
+		if (samples[i].rtt < 0) line += '?';
+		else line += bars[samples[i].rtt * (sizeof(bars) - 1) / (max + 1)];
+	}
+	return line;
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::RankTraces
+//
+// Orders the traces of a fan-out session by loss, then average latency, at
+// their destination hop
+//*****************************************************************************
+std::vector<size_t> WinMTRDialog::RankTraces()
+{
+	std::vector<size_t> order(wmtrnets.size());
+	std::vector<int> loss(wmtrnets.size()), avg(wmtrnets.size());
+	for (size_t t = 0; t < wmtrnets.size(); ++t) {
+		s_hopsnapshot dest;
+		wmtrnets[t]->GetDestination(&dest);
+		order[t] = t;
+		loss[t] = dest.percent;
+		avg[t] = dest.avg;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return loss[a] != loss[b] ? loss[a] < loss[b] : avg[a] < avg[b];
+	});
+	return order;
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::AddTrace
+//
+// Adds a trace running next to the primary one, NULL if its ICMP handles
+// could not be opened
+//*****************************************************************************
+WinMTRNet* WinMTRDialog::AddTrace(sockaddr* target)
+{
+	WinMTRNet* net = new WinMTRNet(this);
+	if (!net->initialized) {
+		net->Release();
+		return NULL;
+	}
+	net->SetTarget(target);
+	wmtrnets.push_back(net);
+	return net;
+}
+
+
+//*****************************************************************************
+// WinMTRDialog::ClearTraces
+//
+// Drops every trace but the primary one; a trace still resolving a hop name
+// goes when its resolver thread is done, see WinMTRNet::Release
+//*****************************************************************************
+void WinMTRDialog::ClearTraces()
+{
+	for (size_t t = 1; t < wmtrnets.size(); ++t)
+		wmtrnets[t]->Release();
+	wmtrnets.resize(1);
+}
+
+
+//*****************************************************************************
+// TraceSessionThread
+//
+// Runs a trace other than the primary one
+//*****************************************************************************
+unsigned WINAPI TraceSessionThread(void* p)
+{
+	WinMTRNet* wmtrnet = (WinMTRNet*)p;
+	wmtrnet->DoTrace(&wmtrnet->target);
+	return 0;
+}
+
+
 //*****************************************************************************
 // PingThread
 //
@@ -1132,30 +2160,25 @@ void PingThread(void* p)
 	WinMTRDialog* wmtrdlg = (WinMTRDialog*)p;
 	WaitForSingleObject(wmtrdlg->traceThreadMutex, INFINITE);
 
-	char hostname[255];
-	wmtrdlg->m_comboHost.GetWindowText(hostname, 255);
-
-	addrinfo nfofilter = { 0 };
-	addrinfo* anfo;
-	if (wmtrdlg->wmtrnet->hasIPv6) {
-		switch (wmtrdlg->useIPv6) {
-		case 0:
-			nfofilter.ai_family = AF_INET; break;
-		case 1:
-			nfofilter.ai_family = AF_INET6; break;
-		default:
-			nfofilter.ai_family = AF_UNSPEC;
+	// all targets were resolved by InitMTRNet, the primary trace runs right here
+	ProbeLog log;
+	if (!wmtrdlg->recordPath.empty() && log.Open(wmtrdlg->recordPath.c_str())) {
+		for (size_t t = 0; t < wmtrdlg->wmtrnets.size(); ++t) {
+			log.AddTrace((int)t, wmtrdlg->wmtrnets[t]);
+			wmtrdlg->wmtrnets[t]->probeLog = &log;
+			wmtrdlg->wmtrnets[t]->probeTrace = (int)t;
 		}
 	}
-	nfofilter.ai_socktype = SOCK_RAW;
-	nfofilter.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;//|AI_V4MAPPED;
-	if (getaddrinfo(hostname, NULL, &nfofilter, &anfo) || !anfo) { //we use first address returned
-		AfxMessageBox("Unable to resolve hostname. (again)");
-		ReleaseMutex(wmtrdlg->traceThreadMutex);
-		return;
-	}
-	wmtrdlg->wmtrnet->DoTrace(anfo->ai_addr);
-	freeaddrinfo(anfo);
+	std::vector<HANDLE> hThreads;
+	for (size_t t = 1; t < wmtrdlg->wmtrnets.size(); ++t)
+		hThreads.push_back((HANDLE)_beginthreadex(NULL, 0, TraceSessionThread, wmtrdlg->wmtrnets[t], 0, NULL));
+	wmtrdlg->wmtrnet->DoTrace(&wmtrdlg->wmtrnet->target);
+	if (!hThreads.empty())
+		WaitForMultipleObjects((DWORD)hThreads.size(), &hThreads[0], TRUE, INFINITE);
+	for (size_t t = 0; t < hThreads.size(); ++t)
+		CloseHandle(hThreads[t]);
+	for (size_t t = 0; t < wmtrdlg->wmtrnets.size(); ++t)
+		wmtrdlg->wmtrnets[t]->probeLog = NULL;
 	ReleaseMutex(wmtrdlg->traceThreadMutex);
 }
 
@@ -1292,7 +2315,17 @@ void WinMTRDialog::Transit(STATES new_state)
 	case STOPPING_TO_IDLE:
 		DisplayRedraw();
 		m_buttonStart.EnableWindow(TRUE);
-		statusBar.SetPaneText(0, CString((LPCSTR)IDS_STRING_SB_NAME));
+		if (m_comboTrace.IsWindowVisible()) {// fan-out summary
+			size_t best = RankTraces()[0];
+			s_hopsnapshot dest;
+			wmtrnets[best]->GetDestination(&dest);
+			char buf[NI_MAXHOST + 100];
+			sprintf(buf, "Best: %s (%d%% loss, %d ms avg) - see exports for the full ranking.", wmtrnets[best]->label,
+				dest.percent, dest.avg);
+			statusBar.SetPaneText(0, buf);
+		}
+		else
+			statusBar.SetPaneText(0, CString((LPCSTR)IDS_STRING_SB_NAME));
 		m_buttonStart.SetWindowText("Start");
 		m_comboHost.EnableWindow(TRUE);
 		m_checkIPv6.EnableWindow(TRUE);
@@ -1309,13 +2342,13 @@ void WinMTRDialog::Transit(STATES new_state)
 		break;
 	case TRACING_TO_STOPPING:
 		m_buttonStart.EnableWindow(FALSE);
-		wmtrnet->StopTrace();
+		for (size_t t = 0; t < wmtrnets.size(); ++t) wmtrnets[t]->StopTrace();
 		statusBar.SetPaneText(0, "Waiting for last packets in order to stop trace ...");
 		DisplayRedraw();
 		break;
 	case TRACING_TO_EXIT:
 		m_buttonStart.EnableWindow(FALSE);
-		wmtrnet->StopTrace();
+		for (size_t t = 0; t < wmtrnets.size(); ++t) wmtrnets[t]->StopTrace();
 		statusBar.SetPaneText(0, "Waiting for last packets in order to stop trace ...");
 		break;
 	default:
@@ -33,6 +33,18 @@ public:
 	std::string Avg;
 	std::string Worst;
 	std::string last;
+	std::string P50;
+	std::string P90;
+	std::string P95;
+	std::string P99;
+	std::string StDev;
+	std::string Jitter;
+	std::string Fwd;
+	std::string Rev;
+	std::string RPath;
+	std::string Burst;
+	std::string Dev;
+	std::string Recent;
 	std::string date;
 };
 
@@ -79,6 +91,9 @@ public:
 	CComboBox m_comboHost;
 	CButton m_checkIPv6;
 	CListCtrl m_listMTR;
+	CListCtrl m_listMTR2;
+	CComboBox m_comboTrace;
+	CComboBox m_comboWindow;
 	//CMFCLinkCtrl m_buttonAppnor;
 	
 	CStatic	m_staticS;
@@ -97,6 +112,8 @@ public:
 	HANDLE				traceThreadMutex;
 	double				interval;
 	bool				hasIntervalFromCmdLine;
+	double				minInterval;	// fastest interval of a hop in trouble, 0: always interval
+	bool				hasMinIntervalFromCmdLine;
 	WORD				pingsize;
 	bool				hasPingsizeFromCmdLine;
 	int					maxLRU;
@@ -106,15 +123,40 @@ public:
 	bool				hasUseDNSFromCmdLine;
 	unsigned char		useIPv6;
 	bool				hasUseIPv6FromCmdLine;
-	WinMTRNet*			wmtrnet;
+	BOOL				useTimestamp;
+	bool				hasUseTimestampFromCmdLine;
+	BOOL				useDualStack;
+	bool				hasUseDualStackFromCmdLine;
+	int					fanout;			// trace up to that many resolved addresses (0/1: first only)
+	bool				hasFanoutFromCmdLine;
+	std::string			dscpList;		// DSCP classes as typed, e.g. "BE,AF41,EF"
+	std::vector<int>	dscpClasses;	// parsed code points, traced concurrently (empty: unmarked)
+	bool				hasDscpFromCmdLine;
+	std::string			alertSpec;		// alert rules as typed, see WinMTRAlert.h
+	std::vector<s_alertrule>	alertRules;	// read by the probe threads, set before tracing
+	bool				hasAlertFromCmdLine;
+	std::string			alertHook;		// command or http(s) URL run on alerts (registry only)
+	std::string			recordPath;		// probe log of each session, see WinMTRReplay.h (command line only)
+	WinMTRNet*			wmtrnet;		// primary trace
+	std::vector<WinMTRNet*>	wmtrnets;	// all traces of the session, primary first
+	size_t				viewTrace;		// trace shown in m_listMTR
+	int					viewWindow;		// 0: totals, else sliding window WINDOW_SECONDS[viewWindow - 1]
 	std::list<std::string>		datalist;
+	std::list<std::string>		eventlist;	// change points, see LogEvents
 
 	void SetHostName(const char* host);
 	void SetInterval(float i);
+	void SetMinInterval(float i);
 	void SetPingSize(WORD ps);
 	void SetMaxLRU(int mlru);
 	void SetUseDNS(BOOL udns);
+	void SetUseTimestamp(BOOL uts);
+	void SetUseDualStack(BOOL uds);
+	void SetFanout(int fo);
+	void SetDscpClasses(const char* list);
+	void SetAlertRules(const char* spec);
 	void SaveDataListToFile(const std::list<std::string>& datalist, const CString& folderPath);
+	void SaveEventListToFile(const CString& folderPath);
 	
 	void MinimizeToTray();
 	void RestoreFromTray();
@@ -130,9 +172,33 @@ private:
 	int m_autostart;
 	char msz_defaulthostname[1000];
 	bool m_bTrayIconVisible = true;
+	std::vector<std::string> pendingAlerts;	// not notified yet, see NotifyAlerts
+	ULONGLONG lastAlertNotify = 0;
+	struct s_replayjob* replayJob = NULL;	// replay in progress, see ReplayLog
+	HANDLE replayThread = NULL;
 
 private:
 	void WriteDataEntry(CStdioFile* file, const std::string& entry);
+	WinMTRNet* AddTrace(sockaddr* target);
+	void ClearTraces();
+	void DisplayTrace(CListCtrl* list, WinMTRNet* net, bool log);
+	void LogEvents();
+	void NotifyAlerts();
+	CString BaselinePath();
+	void SetListTitle(CListCtrl& list, WinMTRNet* net);
+	void ApplyWindow(s_hopsnapshot& hop);
+	std::string Sparkline(WinMTRNet* net, int at);
+	std::vector<size_t> RankTraces();
+	void PositionLists();
+	void ShowHostProperties(CListCtrl& list, WinMTRNet* net);
+	void ShowListMenu(CListCtrl& list, WinMTRNet* net);
+	bool SaveStats(const char* path, const std::vector<WinMTRNet*>& nets, const std::vector<std::vector<s_hopevent> >* events = NULL);
+	void MergeStats();
+	void ReplayLog();
+	void ReplayProgress();
+	std::string ReportText();
+	std::string ReportHtml();
+	void CopyToClipboard(const std::string& source);
 
 protected:
 	virtual void DoDataExchange(CDataExchange* pDX);
@@ -150,6 +216,10 @@ protected:
 	afx_msg void OnEXPT();
 	afx_msg void OnEXPH();
 	afx_msg void OnDblclkList(NMHDR* pNMHDR, LRESULT* pResult);
+	afx_msg void OnDblclkList2(NMHDR* pNMHDR, LRESULT* pResult);
+	afx_msg void OnRclickList(NMHDR* pNMHDR, LRESULT* pResult);
+	afx_msg void OnRclickList2(NMHDR* pNMHDR, LRESULT* pResult);
+	afx_msg void OnCustomDrawList(NMHDR* pNMHDR, LRESULT* pResult);
 	DECLARE_MESSAGE_MAP()
 public:
 	afx_msg void OnCbnSelchangeComboHost();
@@ -158,6 +228,8 @@ private:
 	void ClearHistory();
 public:
 	afx_msg void OnCbnCloseupComboHost();
+	afx_msg void OnCbnSelchangeComboTrace();
+	afx_msg void OnCbnSelchangeComboWindow();
 	afx_msg void OnTimer(UINT_PTR nIDEvent);
 	afx_msg void OnClose();
 	afx_msg void OnBnClickedCancel();
@@ -30,6 +30,7 @@
 #include <afxsock.h>
 #include <Iphlpapi.h>//IP_OPTION_INFORMATION32
 #include <ws2tcpip.h>//sockaddr_in6
+#include <mswsock.h>//WSARecvMsg
 
 #include <process.h>
 #include <stdio.h>
@@ -54,10 +55,20 @@
 
 #define DEFAULT_PING_SIZE	64
 #define DEFAULT_INTERVAL	1.0
+#define DEFAULT_MIN_INTERVAL	0.25	// fastest ping interval of a hop in trouble, see ProbeRate
 #define DEFAULT_MAX_LRU		128
 #define DEFAULT_DNS			TRUE
+#define DEFAULT_TIMESTAMP	FALSE
+#define DEFAULT_DUALSTACK	FALSE
+#define DEFAULT_FANOUT		0
+#define MAX_FANOUT			16
+#define DEFAULT_DSCP		""
+#define MAX_DSCP_CLASSES	8
 
-#define SAVED_PINGS 100
+#define STATS_MAGIC "# WinMTR statistics 1"
+#define STATS_FILTER _T("WinMTR statistics (*.wmtrstats)|*.wmtrstats|All Files (*.*)|*.*||")
+
+#define SPARKLINE_SAMPLES 20
 #define MaxHost 256
 //#define MaxSequence 65536
 #define MaxSequence 32767
@@ -84,7 +95,7 @@
 #define IP_HEADER_LENGTH   20
 
 
-#define MTR_NR_COLS 9
+#define MTR_NR_COLS 21
 
 const char MTR_COLS[ MTR_NR_COLS ][10] = {
 	"Hostname",
@@ -95,11 +106,23 @@ const char MTR_COLS[ MTR_NR_COLS ][10] = {
 	"Best",
 	"Avrg",
 	"Worst",
-	"Last"
+	"Last",
+	"P50",
+	"P90",
+	"P95",
+	"P99",
+	"StDev",
+	"Jitter",
+	"Fwd",
+	"Rev",
+	"RPath",
+	"Burst",
+	"Dev",
+	"Recent"
 };
 
 const int MTR_COL_LENGTH[ MTR_NR_COLS ] = {
-	249, 30, 50, 40, 40, 50, 50, 50, 50
+	249, 30, 50, 40, 40, 50, 50, 50, 50, 40, 40, 40, 40, 45, 45, 40, 40, 45, 40, 40, 120
 };
 
 int gettimeofday(struct timeval* tv, struct timezone* tz);
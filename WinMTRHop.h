@@ -0,0 +1,123 @@
+//*****************************************************************************
+// FILE:            WinMTRHop.h
+//
+//
+// DESCRIPTION:
+//   Per-hop counters of a trace and the seqlock they are read through.
+//   Portable, so tests/WinMTRBench.cpp measures the layout WinMTRNet uses.
+//
+// NOTES:
+//   HOP_CACHE_LINE may be set by the build: the benchmark is built a second
+//   time with the counter groups packed, to measure what the split brings.
+//
+//*****************************************************************************
+
+#ifndef WINMTRHOP_H_
+#define WINMTRHOP_H_
+
+#include "WinMTRStats.h"
+#include "WinMTRAlert.h"
+
+class BaselineProfile;
+
+#ifndef HOP_CACHE_LINE
+#define HOP_CACHE_LINE 64
+#endif
+#define SAVED_PINGS 100
+#define WRITER_NONE 0		// owner of a hop counter group, see WinMTRNet::ResetIdle
+#define WRITER_THREAD 1
+#define WRITER_RESET 2
+
+// Slot of the recent sample ring, see s_sample
+struct s_sampleslot {
+	std::atomic<unsigned long long> time;
+	std::atomic<int> rtt;
+	std::atomic<unsigned> addr_id;	// responder, AddressTable id
+	std::atomic<unsigned> round;	// probe round, 0 if sent between rounds
+};
+
+// Per-hop counters, read without locking. Each group has a single writer
+// thread and starts its own cache line, so the probe threads of neighbouring
+// hops (or the timestamp and listener threads of the same hop) never write to
+// a line another one is writing to.
+struct s_hopstats {
+	// written by the probe thread of the hop
+	alignas(HOP_CACHE_LINE) std::atomic<unsigned> seq;	// seqlock of the echo counters, odd during an update
+	std::atomic<unsigned> epoch;	// last reset_req applied to the echo counters, under seq
+	std::atomic<int> owner;			// WRITER_*: probe thread running, or ResetIdle at work
+	EchoCounters echo;				// probes sent / answered, RTT sum, last / best / worst
+	RunningStats rtt_stats;			// RTT mean, standard deviation and jitter
+	LatencyHistogram rtt_hist;		// RTT distribution, for percentiles
+	SlidingWindow windows[NR_WINDOWS];	// recent sent / received / RTT, see WINDOW_SECONDS
+	LossPattern loss;				// loss runs and Gilbert-Elliott model
+	ChangeDetector changes;			// latency / loss change points, private to the probe thread
+	SampleHistory history;			// every probe, compressed
+	BaselineProfile* baseline;		// profile of (target, baseline_id), private to the probe thread
+	unsigned baseline_id;			// responder of that profile
+	double dev_score;				// smoothed deviation from the baseline, in spreads, private
+	double dev_loss;				// smoothed loss rate, private
+	bool dev_abnormal;				// private
+	std::atomic<int> deviation;		// dev_score in tenths, INT_MIN while there is no baseline
+	std::atomic<bool> abnormal;		// dev_abnormal, published
+	HopAlert alert;					// threshold rules, private to the probe thread
+	ProbeRate rate;					// probe interval, faster while the hop is in trouble
+	SpikeDetector spikes;			// single probe spikes, private to the probe thread
+	std::atomic<unsigned> sample_head;	// samples written so far, the last SAVED_PINGS are kept
+	s_sampleslot samples[SAVED_PINGS];
+	// ICMP timestamp probes (IPv4 only), written by the hop's timestamp thread
+	alignas(HOP_CACHE_LINE) std::atomic<unsigned> ts_seq;	// seqlock of the timestamp counters
+	std::atomic<unsigned> ts_epoch;	// last reset_req applied to the timestamp counters, under ts_seq
+	std::atomic<int> ts_owner;		// as owner, for the timestamp thread
+	std::atomic<unsigned long long> ts_xmit;		// number of ICMP timestamp requests sent
+	std::atomic<unsigned long long> ts_returned;	// number of ICMP timestamp replies received
+	std::atomic<long long> ts_fwd_total;	// sum of raw forward deltas (remote receive - local originate)
+	std::atomic<long long> ts_ret_total;	// sum of raw return deltas (local arrival - remote transmit)
+	std::atomic<int> ts_offset;		// estimated remote clock offset, applied when reading one-way delays
+	int ts_win_best;				// lowest network round trip in the current offset window
+	int ts_win_offset;				// clock offset measured by that sample
+	int ts_win_count;				// replies in the current offset window
+	// written by the listener thread
+	alignas(HOP_CACHE_LINE) std::atomic<unsigned char> reply_ttl;	// IP TTL / hop limit of the last reply (0 = none seen yet)
+	// set once per hop (or on request), read by every thread
+	alignas(HOP_CACHE_LINE) std::atomic<bool> has_addr;	// s_nethost address is set (and final)
+	std::atomic<bool> has_name;		// s_nethost name is set
+	std::atomic<unsigned> reset_req;	// bumped by ResetStats, the writers reset their counters when it moves, readers read zeros until then
+};
+
+//*****************************************************************************
+// Hop counters
+//
+// Each s_hopstats group has a single writer, the probe thread of that TTL (or
+// the hop's timestamp thread, or the listener for reply TTLs), so writers
+// update them with a plain load/store pair and readers never take a lock.
+// Echo counters and timestamp counters each sit behind a seqlock owned by
+// their writer: the sequence is odd during an update, and readers copy until
+// they see the same even value before and after. Names and addresses are set
+// once per hop under ghMutex; has_addr / has_name let the probe threads skip
+// the mutex once they are known.
+//*****************************************************************************
+inline void WriteBegin(std::atomic<unsigned>& seq)
+{
+	seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+inline void WriteEnd(std::atomic<unsigned>& seq)
+{
+	seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+inline unsigned ReadBegin(const std::atomic<unsigned>& seq)
+{
+	unsigned s;
+	while((s = seq.load(std::memory_order_acquire)) & 1) YieldProcessor();
+	return s;
+}
+
+inline bool ReadRetry(const std::atomic<unsigned>& seq, unsigned s)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return seq.load(std::memory_order_relaxed) != s;
+}
+
+#endif	// ifndef WINMTRHOP_H_
@@ -110,6 +110,10 @@ void WinMTRMain::ParseCommandLineParams(LPTSTR cmd, WinMTRDialog* wmtrdlg)
 		wmtrdlg->SetInterval((float)atof(value));
 		wmtrdlg->hasIntervalFromCmdLine = true;
 	}
+	if(GetParamValue(cmd, "minInterval",'r', value)) {
+		wmtrdlg->SetMinInterval((float)atof(value));
+		wmtrdlg->hasMinIntervalFromCmdLine = true;
+	}
 	if(GetParamValue(cmd, "size",'s', value)) {
 		wmtrdlg->SetPingSize((WORD)atoi(value));
 		wmtrdlg->hasPingsizeFromCmdLine = true;
@@ -130,6 +134,29 @@ void WinMTRMain::ParseCommandLineParams(LPTSTR cmd, WinMTRDialog* wmtrdlg)
 		wmtrdlg->hasUseIPv6FromCmdLine=true;
 		wmtrdlg->useIPv6=0;
 	}
+	if(GetParamValue(cmd, "timestamp",'t', NULL)) {
+		wmtrdlg->SetUseTimestamp(TRUE);
+		wmtrdlg->hasUseTimestampFromCmdLine = true;
+	}
+	if(GetParamValue(cmd, "fanout",'f', value)) {
+		wmtrdlg->SetFanout(atoi(value));
+		wmtrdlg->hasFanoutFromCmdLine = true;
+	}
+	if(GetParamValue(cmd, "dscp",'q', value)) {
+		wmtrdlg->SetDscpClasses(value);
+		wmtrdlg->hasDscpFromCmdLine = true;
+	}
+	if(GetParamValue(cmd, "alert",'a', value)) {
+		wmtrdlg->SetAlertRules(value);
+		wmtrdlg->hasAlertFromCmdLine = true;
+	}
+	if(GetParamValue(cmd, "record",'w', value)) {
+		wmtrdlg->recordPath = value;
+	}
+	if(GetParamValue(cmd, "dual",'d', NULL)) {
+		wmtrdlg->SetUseDualStack(TRUE);
+		wmtrdlg->hasUseDualStackFromCmdLine = true;
+	}
 }
 
 //*****************************************************************************
@@ -205,7 +232,7 @@ int WinMTRMain::GetHostNameParamValue(LPTSTR cmd, std::string& host_name)
 		possible_argument = cmd[size] + possible_argument;
 	}
 	
-	if(possible_argument.length() && (possible_argument[0] != '-' || possible_argument == "-n" || possible_argument == "--numeric" || possible_argument == "-6" || possible_argument == "--ipv6" || possible_argument == "-4" || possible_argument == "--ipv4")) {
+	if(possible_argument.length() && (possible_argument[0] != '-' || possible_argument == "-n" || possible_argument == "--numeric" || possible_argument == "-6" || possible_argument == "--ipv6" || possible_argument == "-4" || possible_argument == "--ipv4" || possible_argument == "-t" || possible_argument == "--timestamp" || possible_argument == "-d" || possible_argument == "--dual")) {
 		host_name = name;
 		return 1;
 	}
@@ -5,9 +5,13 @@
 #include "pch.h"
 #include "WinMTRGlobal.h"
 #include "WinMTRNet.h"
+#include "WinMTRTopology.h"
+#include "WinMTRBaseline.h"
+#include "WinMTRReplay.h"
 #include "WinMTRDialog.h"
 #include <iostream>
 #include <sstream>
+#include <climits>
 
 #ifdef _DEBUG
 #	define TRACE_MSG(msg)										\
@@ -23,6 +27,25 @@
 #define IPFLAG_DONT_FRAGMENT	0x02
 #define MAX_HOPS				30
 
+#define TSTAMP_DAY_MS			86400000	// ICMP timestamps are milliseconds since midnight UT
+#define TSTAMP_NONSTANDARD		0x80000000	// high bit set: not a standard timestamp (RFC 792)
+#define TSTAMP_OFFSET_WINDOW	64			// replies per clock offset estimation window
+
+#define ASYMMETRY_HOPS			2			// return vs forward path length difference flagged as asymmetric
+
+#pragma pack(push,1)
+struct icmp_timestamp {
+	u_char	type;
+	u_char	code;
+	u_short	checksum;
+	u_short	id;
+	u_short	seq;
+	u_long	originate;
+	u_long	receive;
+	u_long	transmit;
+};
+#pragma pack(pop)
+
 struct trace_thread {
 	WinMTRNet*	winmtr;
 	in_addr		address;
@@ -34,23 +57,141 @@ struct trace_thread6 {
 	int				ttl;
 };
 
-struct dns_resolver_thread {
+struct listener_thread {
+	WinMTRNet*	winmtr;
+	union {
+		sockaddr		addr;
+		sockaddr_in		addr4;
+		sockaddr_in6	addr6;
+	};
+};
+
+struct timestamp_thread {
 	WinMTRNet*	winmtr;
 	int			index;
 };
 
+struct dns_resolver_thread {
+	WinMTRNet*	winmtr;		// referenced until the thread is done
+	int			index;
+	bool		resolve;	// reverse lookup too, useDNS when started
+};
+
 unsigned WINAPI TraceThread(void* p);
 unsigned WINAPI TraceThread6(void* p);
+unsigned WINAPI TimestampThread(void* p);
+unsigned WINAPI ListenerThread(void* p);
 void DnsResolverThread(void* p);
 
+AddressTable addresses;
+
+AddressTable::AddressTable()
+{
+	InitializeSRWLock(&lock);
+	for(int c=0; c<ADDR_MAX_CHUNKS; ++c) chunks[c].store(NULL, std::memory_order_relaxed);
+	chunks[0].store(new sockaddr_in6[1 << ADDR_CHUNK_BITS](), std::memory_order_relaxed);
+	count = 1;// id 0: unknown, all zero
+}
+
+AddressTable::~AddressTable()
+{
+	for(int c=0; c<ADDR_MAX_CHUNKS; ++c) delete[] chunks[c].load(std::memory_order_relaxed);
+}
+
+size_t AddressTable::KeyHash::operator()(const Key& k) const
+{
+	unsigned long long h = k.family;
+	for(int w=0; w<4; ++w) h = (h ^ k.words[w]) * 0x9E3779B97F4A7C15ULL;
+	return (size_t)(h ^ (h >> 32));
+}
+
+bool AddressTable::MakeKey(const sockaddr* addr, Key* key)
+{
+	memset(key, 0, sizeof(*key));
+	if(!addr) return false;
+	key->family = addr->sa_family;
+	if(addr->sa_family==AF_INET6)
+		memcpy(key->words, &((const sockaddr_in6*)addr)->sin6_addr, sizeof(in6_addr));
+	else if(addr->sa_family==AF_INET)
+		key->words[0] = ((const sockaddr_in*)addr)->sin_addr.s_addr;
+	else
+		return false;
+	return (key->words[0] | key->words[1] | key->words[2] | key->words[3]) != 0;
+}
+
+//*****************************************************************************
+// AddressTable::Intern
+//
+// Known addresses (nearly every call) only take the lock shared. A new
+// entry is written before its id is handed out, readers get the id through
+// a release store (has_addr, the sample ring) or ghMutex.
+//*****************************************************************************
+unsigned AddressTable::Intern(const sockaddr* addr)
+{
+	unsigned id = Find(addr);
+	Key key;
+	if(id || !MakeKey(addr, &key)) return id;
+	AcquireSRWLockExclusive(&lock);
+	std::unordered_map<Key, unsigned, KeyHash>::iterator it = ids.find(key);
+	if(it != ids.end()) {
+		id = it->second;
+	} else if(count < (ADDR_MAX_CHUNKS << ADDR_CHUNK_BITS)) {// full: reads as unknown
+		unsigned c = count >> ADDR_CHUNK_BITS;
+		sockaddr_in6* chunk = chunks[c].load(std::memory_order_relaxed);
+		if(!chunk) {
+			chunk = new sockaddr_in6[1 << ADDR_CHUNK_BITS]();
+			chunks[c].store(chunk, std::memory_order_release);
+		}
+		id = count++;
+		memcpy(&chunk[id & ((1 << ADDR_CHUNK_BITS) - 1)], addr, addr->sa_family==AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+		ids[key] = id;
+	}
+	ReleaseSRWLockExclusive(&lock);
+	return id;
+}
+
+unsigned AddressTable::Find(const sockaddr* addr)
+{
+	Key key;
+	if(!MakeKey(addr, &key)) return 0;
+	AcquireSRWLockShared(&lock);
+	std::unordered_map<Key, unsigned, KeyHash>::const_iterator it = ids.find(key);
+	unsigned id = it != ids.end() ? it->second : 0;
+	ReleaseSRWLockShared(&lock);
+	return id;
+}
+
+const sockaddr* AddressTable::Get(unsigned id)
+{
+	return (const sockaddr*)&chunks[id >> ADDR_CHUNK_BITS].load(std::memory_order_acquire)[id & ((1 << ADDR_CHUNK_BITS) - 1)];
+}
+
 WinMTRNet::WinMTRNet(WinMTRDialog* wp)
 {
 
 	ghMutex = CreateMutex(NULL, FALSE, NULL);
+	refs = 1;
+	stats = (s_hopstats*)_aligned_malloc(sizeof(s_hopstats) * MAX_HOPS, HOP_CACHE_LINE);// new won't align past 16 bytes before C++17, ResetHops() fills it
+	for(int at=0; at<MAX_HOPS; ++at) {
+		new(&stats[at]) s_hopstats();// value initialized: atomics zeroed
+		stats[at].history.Init();
+		stats[at].seq = 0;
+		stats[at].ts_seq = 0;
+		stats[at].owner = WRITER_NONE;
+		stats[at].ts_owner = WRITER_NONE;
+	}
+	rounds = new std::atomic<unsigned long long>[ROUND_SLOTS * MAX_HOPS];
 	hasIPv6=true;
 	tracing=false;
 	initialized = false;
 	wmtrdlg = wp;
+	memset(&target6, 0, sizeof(target6));
+	*label = '\0';
+	tos = 0;
+	target_id = 0;
+	probeLog = NULL;
+	probeTrace = 0;
+	vclock = 0;
 	WSADATA wsaData;
 	
 	if(WSAStartup(MAKEWORD(2, 2), &wsaData)) {
@@ -121,46 +262,249 @@ WinMTRNet::~WinMTRNet()
 		
 		CloseHandle(ghMutex);
 	}
+	for(int at=0; at<MAX_HOPS; ++at) {
+		stats[at].history.Clear();
+		stats[at].~s_hopstats();
+	}
+	_aligned_free(stats);
+	delete[] rounds;
+}
+
+//*****************************************************************************
+// WinMTRNet::Release
+//
+// Owners drop a trace through Release rather than delete: a resolver thread
+// of one of its hops may still be waiting for a reverse lookup, the last
+// reference deletes it
+//*****************************************************************************
+void WinMTRNet::AddRef()
+{
+	refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WinMTRNet::Release()
+{
+	if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+}
+
+void WinMTRNet::SetTarget(sockaddr* addr)
+{
+	memset(&target6, 0, sizeof(target6));
+	tos = 0;
+	memcpy(&target, addr, addr->sa_family==AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+	if(getnameinfo(&target, sizeof(sockaddr_in6), label, NI_MAXHOST, NULL, 0, NI_NUMERICHOST))
+		*label = '\0';
+}
+
+//*****************************************************************************
+// WinMTRNet::SetDscp
+//
+// Marks the probes of this trace with a DSCP code point and names the class
+// in the label (call after SetTarget)
+//*****************************************************************************
+void WinMTRNet::SetDscp(int dscp)
+{
+	char name[16];
+	tos = (unsigned char)(dscp << 2);
+	if(!dscp)
+		strcpy(name, "BE");
+	else if(dscp == 46)
+		strcpy(name, "EF");
+	else if(!(dscp & 7))
+		sprintf(name, "CS%d", dscp >> 3);
+	else if(!(dscp & 1) && (dscp & 7) <= 6 && (dscp >> 3) >= 1 && (dscp >> 3) <= 4)
+		sprintf(name, "AF%d%d", dscp >> 3, (dscp & 7) >> 1);
+	else
+		sprintf(name, "DSCP %d", dscp);
+	size_t len = strlen(label);
+	_snprintf(label + len, NI_MAXHOST - len, " [%s]", name);
+	label[NI_MAXHOST - 1] = '\0';
 }
 
 void WinMTRNet::ResetHops()
 {
 	memset(host,0,sizeof(host));
+	events.clear();
+	spikes.clear();
+	cur_round = 0;
+	round_due = 0;
+	for(int c=0; c<ROUND_SLOTS*MAX_HOPS; ++c) rounds[c].store(0, std::memory_order_relaxed);
+	for(int at=0; at<MAX_HOPS; ++at) {// no probe thread runs at this point, the dialog may be reading
+		s_hopstats& s = stats[at];
+		WriteBegin(s.seq);
+		ResetEcho(s);
+		WriteEnd(s.seq);
+		WriteBegin(s.ts_seq);
+		ResetTimestamp(s);
+		WriteEnd(s.ts_seq);
+		s.history.Clear();
+		s.sample_head = 0;
+		s.ts_offset = 0;
+		s.reply_ttl = 0;
+		s.has_addr = false;
+		s.has_name = false;
+		s.reset_req = 0;
+		s.baseline = NULL;
+		s.baseline_id = 0;
+		s.epoch = 0;
+		s.ts_epoch = 0;
+	}
+}
+
+//*****************************************************************************
+// WinMTRNet::ResetStats
+//
+// Zeroes the statistics of one hop, or of all of them (at = -1), while the
+// trace goes on. Each counter group is reset by its own writer thread before
+// its next probe, under its seqlock, so the probe in flight is still counted
+// in full and readers never see a half reset hop; meanwhile readers see the
+// group as zeroed (ReadCounters, GetSummary). Groups without a running
+// writer, such as hops past the destination or a stopped trace, are reset
+// here, see ResetIdle. The detectors fed by the probes (change points, spikes, alert
+// rules, baseline deviation, probe rate) restart with the counters: a raised
+// alert or an abnormal hop ends without a "cleared" event, on the user's own
+// request. Names, addresses, reply TTLs, the clock offset estimate, the
+// sample ring / history and the baseline profiles are kept: they describe
+// the path, not the counting.
+//*****************************************************************************
+void WinMTRNet::ResetStats(int at)
+{
+	for(int i = (at < 0 ? 0 : at); i < (at < 0 ? MAX_HOPS : at + 1); ++i) {
+		stats[i].reset_req.fetch_add(1, std::memory_order_release);
+		ResetIdle(i, false);
+		ResetIdle(i, true);
+	}
+}
+
+//*****************************************************************************
+// WinMTRNet::ResetIdle
+//
+// Applies a pending reset to a counter group nobody writes to. The group
+// is taken over (WRITER_RESET) only while no thread owns it; a running
+// writer resets it itself, and looks again on the way out (ReleaseWriter).
+// Requests made during the reset are caught by the loop.
+//*****************************************************************************
+void WinMTRNet::ResetIdle(int at, bool timestamp)
+{
+	s_hopstats& s = stats[at];
+	std::atomic<int>& owner = timestamp ? s.ts_owner : s.owner;
+	std::atomic<unsigned>& seq = timestamp ? s.ts_seq : s.seq;
+	std::atomic<unsigned>& epoch = timestamp ? s.ts_epoch : s.epoch;
+	while(s.reset_req.load(std::memory_order_acquire) != epoch.load(std::memory_order_relaxed)) {
+		int none = WRITER_NONE;
+		if(!owner.compare_exchange_strong(none, WRITER_RESET, std::memory_order_acquire)) return;
+		WriteBegin(seq);
+		unsigned req = s.reset_req.load(std::memory_order_acquire);
+		if(timestamp) ResetTimestamp(s);
+		else ResetEcho(s);
+		epoch.store(req, std::memory_order_relaxed);
+		WriteEnd(seq);
+		owner.store(WRITER_NONE, std::memory_order_release);
+	}
+}
+
+//*****************************************************************************
+// WinMTRNet::ClaimWriter
+//
+// A probe (timestamp) thread becomes the single writer of the echo
+// (timestamp) counters of its hop, waiting for a ResetIdle to finish
+//*****************************************************************************
+void WinMTRNet::ClaimWriter(int at, bool timestamp)
+{
+	std::atomic<int>& owner = timestamp ? stats[at].ts_owner : stats[at].owner;
+	int none = WRITER_NONE;
+	while(!owner.compare_exchange_weak(none, WRITER_THREAD, std::memory_order_acquire)) {
+		none = WRITER_NONE;
+		Sleep(0);
+	}
+}
+
+void WinMTRNet::ReleaseWriter(int at, bool timestamp)
+{
+	(timestamp ? stats[at].ts_owner : stats[at].owner).store(WRITER_NONE, std::memory_order_release);
+	ResetIdle(at, timestamp);
+}
+
+//*****************************************************************************
+// WinMTRNet::ResetEcho
+//
+// Owner of the echo counters only (see ClaimWriter, ResetIdle), inside
+// their seqlock write section
+//*****************************************************************************
+void WinMTRNet::ResetEcho(s_hopstats& s)
+{
+	s.echo.Reset();
+	s.rtt_stats.Reset();
+	s.rtt_hist.Reset();
+	for(int w=0; w<NR_WINDOWS; ++w) s.windows[w].Reset(WINDOW_SECONDS[w]);
+	s.loss.Reset();
+	s.changes.Reset();
+	s.spikes.Reset();
+	s.alert.Reset();
+	s.rate.Reset();
+	s.dev_score = 0;
+	s.dev_loss = 0;
+	s.dev_abnormal = false;
+	s.deviation.store(INT_MIN, std::memory_order_relaxed);
+	s.abnormal.store(false, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// WinMTRNet::ResetTimestamp
+//
+// Owner of the timestamp counters only, inside their seqlock write section
+//*****************************************************************************
+void WinMTRNet::ResetTimestamp(s_hopstats& s)
+{
+	s.ts_xmit.store(0, std::memory_order_relaxed);
+	s.ts_returned.store(0, std::memory_order_relaxed);
+	s.ts_fwd_total.store(0, std::memory_order_relaxed);
+	s.ts_ret_total.store(0, std::memory_order_relaxed);
+	s.ts_win_best = 0;
+	s.ts_win_offset = 0;
+	s.ts_win_count = 0;
 }
 
 void WinMTRNet::DoTrace(sockaddr* sockaddr)
 {
-	HANDLE hThreads[MAX_HOPS];
-	unsigned char hops=0;
+	HANDLE hThreads[MAX_HOPS*2+1];
+	unsigned char hops=0, threads=0;
 	tracing = true;
 	ResetHops();
+	listener_thread* lst=new listener_thread;// reply TTLs, the ICMP API doesn't report them
+	lst->winmtr=this;
+	memcpy(&lst->addr, sockaddr, sockaddr->sa_family==AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+	hThreads[threads++]=(HANDLE)_beginthreadex(NULL,0,ListenerThread,lst,0,NULL);
+	target_id=addresses.Intern(sockaddr);
 	if(sockaddr->sa_family==AF_INET6) {
-		host[0].addr6.sin6_family=AF_INET6;
-		last_remote_addr6=((sockaddr_in6*)sockaddr)->sin6_addr;
 		for(; hops<MAX_HOPS;) {// one thread per TTL value
 			trace_thread6* current=new trace_thread6;
 			current->address=*(sockaddr_in6*)sockaddr;
 			current->winmtr=this;
 			current->ttl=hops+1;
-			hThreads[hops]=(HANDLE)_beginthreadex(NULL,0,TraceThread6,current,0,NULL);
+			hThreads[threads++]=(HANDLE)_beginthreadex(NULL,0,TraceThread6,current,0,NULL);
 			Sleep(30);
 			if(++hops>this->GetMax()) break;
 		}
 	} else {
-		host[0].addr.sin_family=AF_INET;
-		last_remote_addr=((sockaddr_in*)sockaddr)->sin_addr;
 		for(; hops<MAX_HOPS;) {// one thread per TTL value
 			trace_thread* current=new trace_thread;
 			current->address=((sockaddr_in*)sockaddr)->sin_addr;
 			current->winmtr=this;
 			current->ttl=hops+1;
-			hThreads[hops]=(HANDLE)_beginthreadex(NULL,0,TraceThread,current,0,NULL);
+			hThreads[threads++]=(HANDLE)_beginthreadex(NULL,0,TraceThread,current,0,NULL);
+			if(wmtrdlg->useTimestamp) {// ICMP timestamps are IPv4 only
+				timestamp_thread* tst=new timestamp_thread;
+				tst->winmtr=this;
+				tst->index=hops;
+				hThreads[threads++]=(HANDLE)_beginthreadex(NULL,0,TimestampThread,tst,0,NULL);
+			}
 			Sleep(30);
 			if(++hops>this->GetMax()) break;
 		}
 	}
-	WaitForMultipleObjects(hops, hThreads, TRUE, INFINITE);
-	for(; hops;) CloseHandle(hThreads[--hops]);
+	WaitForMultipleObjects(threads, hThreads, TRUE, INFINITE);
+	for(; threads;) CloseHandle(hThreads[--threads]);
 }
 
 void WinMTRNet::StopTrace()
@@ -184,15 +528,20 @@ unsigned WINAPI TraceThread(void* p)
 	
 	lpstIPInfo				= &stIPInfo;
 	stIPInfo.Ttl			= (UCHAR)current->ttl;
-	stIPInfo.Tos			= 0;
+	stIPInfo.Tos			= wmtrnet->tos;
 	stIPInfo.Flags			= IPFLAG_DONT_FRAGMENT;
 	stIPInfo.OptionsSize	= 0;
 	stIPInfo.OptionsData	= NULL;
 	for(int i=0; i<nDataLen; ++i) achReqData[i]=32;//whitespaces
+	wmtrnet->ClaimWriter(current->ttl - 1, false);
+	unsigned last_round = 0;
+	ULONGLONG sent = 0;
 	while(wmtrnet->tracing) {
 		// For some strange reason, ICMP API is not filling the TTL for icmp echo reply
 		// Check if the current thread should be closed
 		if(current->ttl > wmtrnet->GetMax()) break;
+		unsigned round = wmtrnet->WaitProbe(current->ttl - 1, &last_round, &sent);
+		if(!wmtrnet->tracing) break;
 		// NOTE: some servers does not respond back everytime, if TTL expires in transit; e.g. :
 		// ping -n 20 -w 5000 -l 64 -i 7 www.chinapost.com.tw  -> less that half of the replies are coming back from 219.80.240.93
 		// but if we are pinging ping -n 20 -w 5000 -l 64 219.80.240.93  we have 0% loss
@@ -203,29 +552,27 @@ unsigned WINAPI TraceThread(void* p)
 		DWORD dwReplyCount = wmtrnet->lpfnIcmpSendEcho2(wmtrnet->hICMP, 0,NULL,NULL, current->address, achReqData, nDataLen, lpstIPInfo, achRepData, sizeof(achRepData), ECHO_REPLY_TIMEOUT);
 		wmtrnet->AddXmit(current->ttl - 1);
 		if(dwReplyCount) {
+			sockaddr_in from = { AF_INET };
+			from.sin_addr.s_addr = icmp_echo_reply.Address;
 			//GG TRACE_MSG("TTL " << (int)current->ttl << " reply TTL " << (int)icmp_echo_reply.Options.Ttl << " Status " << icmp_echo_reply.Status << " Reply count " << dwReplyCount);
 			switch(icmp_echo_reply.Status) {
 			case IP_SUCCESS:
 			case IP_TTL_EXPIRED_TRANSIT:
-				wmtrnet->UpdateRTT(current->ttl - 1, icmp_echo_reply.RoundTripTime);
-				wmtrnet->AddReturned(current->ttl - 1);
+				wmtrnet->AddReply(current->ttl - 1, icmp_echo_reply.RoundTripTime);
+				wmtrnet->AddSample(current->ttl - 1, icmp_echo_reply.RoundTripTime, (sockaddr*)&from, round);
 				wmtrnet->SetAddr(current->ttl - 1, icmp_echo_reply.Address);
 				break;
 			default:
+				wmtrnet->AddSample(current->ttl - 1, -1, (sockaddr*)&from, round);
 				wmtrnet->SetErrorName(current->ttl - 1, icmp_echo_reply.Status);
 			}
-			if((DWORD)(wmtrnet->wmtrdlg->interval * 1000) > icmp_echo_reply.RoundTripTime)
-				Sleep((DWORD)(wmtrnet->wmtrdlg->interval * 1000) - icmp_echo_reply.RoundTripTime);
 		} else {
 			DWORD err=GetLastError();
+			wmtrnet->AddSample(current->ttl - 1, -1, NULL, round);
 			wmtrnet->SetErrorName(current->ttl - 1, err);
-			switch(err) {
-			case IP_REQ_TIMED_OUT: break;
-			default:
-				Sleep((DWORD)(wmtrnet->wmtrdlg->interval * 1000));
-			}
 		}
 	}//end loop
+	wmtrnet->ReleaseWriter(current->ttl - 1, false);
 	TRACE_MSG("Thread with TTL=" << (int)current->ttl << " stopped.");
 	delete p;
 	return 0;
@@ -248,47 +595,275 @@ unsigned WINAPI TraceThread6(void* p)
 	
 	lpstIPInfo				= &stIPInfo;
 	stIPInfo.Ttl			= (UCHAR)current->ttl;
-	stIPInfo.Tos			= 0;
+	stIPInfo.Tos			= wmtrnet->tos;
 	stIPInfo.Flags			= IPFLAG_DONT_FRAGMENT;
 	stIPInfo.OptionsSize	= 0;
 	stIPInfo.OptionsData	= NULL;
 	for(int i=0; i<nDataLen; ++i) achReqData[i]=32;//whitespaces
+	wmtrnet->ClaimWriter(current->ttl - 1, false);
+	unsigned last_round = 0;
+	ULONGLONG sent = 0;
 	while(wmtrnet->tracing) {
 		if(current->ttl > wmtrnet->GetMax()) break;
+		unsigned round = wmtrnet->WaitProbe(current->ttl - 1, &last_round, &sent);
+		if(!wmtrnet->tracing) break;
 		DWORD dwReplyCount = wmtrnet->lpfnIcmp6SendEcho2(wmtrnet->hICMP6, 0,NULL,NULL, &sockaddrfrom, &current->address, achReqData, nDataLen, lpstIPInfo, achRepData, sizeof(achRepData), ECHO_REPLY_TIMEOUT);
 		wmtrnet->AddXmit(current->ttl - 1);
 		if(dwReplyCount) {
+			sockaddr_in6 from = { AF_INET6 };
+			memcpy(&from.sin6_addr, icmpv6_echo_reply.Address.sin6_addr, sizeof(in6_addr));
 			TRACE_MSG("TTL " << (int)current->ttl << " Status " << icmpv6_echo_reply.Status << " Reply count " << dwReplyCount);
 			switch(icmpv6_echo_reply.Status) {
 			case IP_SUCCESS:
 			case IP_TTL_EXPIRED_TRANSIT:
-				wmtrnet->UpdateRTT(current->ttl - 1, icmpv6_echo_reply.RoundTripTime);
-				wmtrnet->AddReturned(current->ttl - 1);
+				wmtrnet->AddReply(current->ttl - 1, icmpv6_echo_reply.RoundTripTime);
+				wmtrnet->AddSample(current->ttl - 1, icmpv6_echo_reply.RoundTripTime, (sockaddr*)&from, round);
 				wmtrnet->SetAddr6(current->ttl - 1, icmpv6_echo_reply.Address);
 				break;
 			default:
+				wmtrnet->AddSample(current->ttl - 1, -1, (sockaddr*)&from, round);
 				wmtrnet->SetErrorName(current->ttl - 1, icmpv6_echo_reply.Status);
 			}
-			if((DWORD)(wmtrnet->wmtrdlg->interval * 1000) > icmpv6_echo_reply.RoundTripTime)
-				Sleep((DWORD)(wmtrnet->wmtrdlg->interval * 1000) - icmpv6_echo_reply.RoundTripTime);
 		} else {
 			DWORD err=GetLastError();
+			wmtrnet->AddSample(current->ttl - 1, -1, NULL, round);
 			wmtrnet->SetErrorName(current->ttl - 1, err);
-			switch(err) {
-			case IP_REQ_TIMED_OUT: break;
-			default:
-				Sleep((DWORD)(wmtrnet->wmtrdlg->interval * 1000));
-			}
 		}
 	}//end loop
+	wmtrnet->ReleaseWriter(current->ttl - 1, false);
 	TRACE_MSG("Thread with TTL=" << (int)current->ttl << " stopped.");
 	delete p;
 	return 0;
 }
 
-sockaddr* WinMTRNet::GetAddr(int at)
+//*****************************************************************************
+// ICMP timestamp helpers
+//
+// Timestamps are milliseconds since midnight UT and wrap once a day.
+//*****************************************************************************
+static u_long TimestampNow()
+{
+	SYSTEMTIME st;
+	GetSystemTime(&st);
+	return ((st.wHour*60 + st.wMinute)*60 + st.wSecond)*1000 + st.wMilliseconds;
+}
+
+static int TimestampDiff(u_long a, u_long b)
+{
+	long d = (long)(a % TSTAMP_DAY_MS) - (long)(b % TSTAMP_DAY_MS);
+	if(d > TSTAMP_DAY_MS/2) d -= TSTAMP_DAY_MS;
+	else if(d <= -TSTAMP_DAY_MS/2) d += TSTAMP_DAY_MS;
+	return (int)d;
+}
+
+static u_short IcmpChecksum(const void* data, int len)
+{
+	const u_short* w = (const u_short*)data;
+	unsigned long sum = 0;
+	for(; len > 1; len -= 2) sum += *w++;
+	if(len) sum += *(const u_char*)w;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return (u_short)~sum;
+}
+
+//*****************************************************************************
+// TimestampThread
+//
+// Sends ICMP timestamp requests (type 13) straight to an already discovered hop
+// and feeds the originate/receive/transmit triple into the hop statistics.
+// Needs a raw socket, i.e. administrative rights.
+//*****************************************************************************
+unsigned WINAPI TimestampThread(void* p)
+{
+	timestamp_thread* current = (timestamp_thread*)p;
+	WinMTRNet* wmtrnet = current->winmtr;
+	TRACE_MSG("Timestamp thread for hop " << current->index + 1 << " started.");
+	
+	SOCKET sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+	if(sock == INVALID_SOCKET) {
+		TRACE_MSG("Timestamp thread: raw socket failed with " << WSAGetLastError());
+		delete p;
+		return 0;
+	}
+	if(wmtrnet->tos) {
+		DWORD tos = wmtrnet->tos;
+		setsockopt(sock, IPPROTO_IP, IP_TOS, (const char*)&tos, sizeof(tos));
+	}
+	wmtrnet->ClaimWriter(current->index, true);
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	u_short id = (u_short)GetCurrentThreadId();
+	u_short seq = 0;
+	char achRepData[1024];
+	while(wmtrnet->tracing) {
+		if(current->index + 1 > wmtrnet->GetMax()) break;
+		DWORD dwInterval = wmtrnet->ProbeInterval(current->index);
+		sockaddr_in dest = *(sockaddr_in*)wmtrnet->GetAddr(current->index);
+		if(!dest.sin_addr.s_addr) {// hop not discovered (yet)
+			Sleep(dwInterval);
+			continue;
+		}
+		dest.sin_family = AF_INET;
+		dest.sin_port = 0;
+		
+		icmp_timestamp req = {0};
+		req.type		= ICMP_TSTAMP;
+		req.id			= htons(id);
+		req.seq			= htons(++seq);
+		req.originate	= htonl(TimestampNow());
+		req.checksum	= IcmpChecksum(&req, sizeof(req));
+		
+		LARGE_INTEGER start, now;
+		QueryPerformanceCounter(&start);
+		if(sendto(sock, (const char*)&req, sizeof(req), 0, (sockaddr*)&dest, sizeof(dest)) == SOCKET_ERROR) {
+			Sleep(dwInterval);
+			continue;
+		}
+		wmtrnet->AddTimestampXmit(current->index);
+		
+		int rtt = -1;
+		for(;;) {
+			QueryPerformanceCounter(&now);
+			int elapsed = (int)((now.QuadPart - start.QuadPart) * 1000 / freq.QuadPart);
+			if(elapsed >= ECHO_REPLY_TIMEOUT) break;
+			fd_set readfds;
+			FD_ZERO(&readfds);
+			FD_SET(sock, &readfds);
+			timeval tv = { (ECHO_REPLY_TIMEOUT - elapsed) / 1000, ((ECHO_REPLY_TIMEOUT - elapsed) % 1000) * 1000 };
+			if(select(0, &readfds, NULL, NULL, &tv) <= 0) break;
+			sockaddr_in from;
+			int fromlen = sizeof(from);
+			int len = recvfrom(sock, achRepData, sizeof(achRepData), 0, (sockaddr*)&from, &fromlen);
+			if(len == SOCKET_ERROR) break;
+			int hlen = (achRepData[0] & 0x0f) * 4;// raw IPv4 sockets deliver the IP header
+			if(len < hlen + (int)sizeof(icmp_timestamp)) continue;
+			icmp_timestamp* rep = (icmp_timestamp*)(achRepData + hlen);
+			if(rep->type != ICMP_TSTAMPREPLY || rep->id != req.id || rep->seq != req.seq) continue;
+			QueryPerformanceCounter(&now);
+			rtt = (int)((now.QuadPart - start.QuadPart) * 1000 / freq.QuadPart);
+			wmtrnet->UpdateTimestamp(current->index, ntohl(req.originate), ntohl(rep->receive), ntohl(rep->transmit), rtt);
+			break;
+		}
+		QueryPerformanceCounter(&now);// reply, timeout or socket error alike: keep the interval
+		DWORD spent = (DWORD)((now.QuadPart - start.QuadPart) * 1000 / freq.QuadPart);
+		if(spent < dwInterval)
+			Sleep(dwInterval - spent);
+	}
+	wmtrnet->ReleaseWriter(current->index, true);
+	closesocket(sock);
+	TRACE_MSG("Timestamp thread for hop " << current->index + 1 << " stopped.");
+	delete p;
+	return 0;
+}
+
+//*****************************************************************************
+// ListenerThread
+//
+// Raw socket receive path next to the ICMP API: every ICMP reply coming from a
+// known hop has its IP TTL (IPv4 header) or hop limit (IPv6 ancillary data)
+// recorded. Without administrative rights the raw socket can't be opened and
+// the thread quits.
+//*****************************************************************************
+unsigned WINAPI ListenerThread(void* p)
+{
+	listener_thread* current = (listener_thread*)p;
+	WinMTRNet* wmtrnet = current->winmtr;
+	int family = current->addr.sa_family;
+	int addrlen = family==AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+	TRACE_MSG("Listener thread started.");
+	
+	// bind to the interface the probes leave through
+	sockaddr_in6 local = {0};
+	int locallen = sizeof(local);
+	SOCKET sock = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	if(sock != INVALID_SOCKET) {
+		current->addr4.sin_port = htons(33434);// same offset as sin6_port
+		if(connect(sock, &current->addr, addrlen) || getsockname(sock, (sockaddr*)&local, &locallen))
+			local.sin6_family = 0;
+		closesocket(sock);
+	}
+	sock = INVALID_SOCKET;
+	if(local.sin6_family)
+		sock = socket(family, SOCK_RAW, family==AF_INET6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP);
+	if(sock == INVALID_SOCKET || bind(sock, (sockaddr*)&local, locallen)) {
+		TRACE_MSG("Listener thread: raw socket failed with " << WSAGetLastError());
+		if(sock != INVALID_SOCKET) closesocket(sock);
+		delete p;
+		return 0;
+	}
+	LPFN_WSARECVMSG lpfnWSARecvMsg = NULL;
+	if(family == AF_INET6) {
+		DWORD on = 1, bytes;
+		GUID guid = WSAID_WSARECVMSG;
+		setsockopt(sock, IPPROTO_IPV6, IPV6_HOPLIMIT, (const char*)&on, sizeof(on));
+		WSAIoctl(sock, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid), &lpfnWSARecvMsg, sizeof(lpfnWSARecvMsg), &bytes, NULL, NULL);
+	}
+	char achRepData[1500];
+	char achControl[WSA_CMSG_SPACE(sizeof(int))];
+	while(wmtrnet->tracing) {
+		fd_set readfds;
+		FD_ZERO(&readfds);
+		FD_SET(sock, &readfds);
+		timeval tv = { 0, 500000 };// recheck tracing twice a second
+		int ready = select(0, &readfds, NULL, NULL, &tv);
+		if(ready == SOCKET_ERROR) break;
+		if(!ready) continue;
+		sockaddr_in6 from;
+		int ttl = -1;
+		if(family == AF_INET6) {
+			if(!lpfnWSARecvMsg) break;
+			WSABUF wsabuf = { sizeof(achRepData), achRepData };
+			WSAMSG msg = {0};
+			DWORD len;
+			msg.name			= (sockaddr*)&from;
+			msg.namelen			= sizeof(from);
+			msg.lpBuffers		= &wsabuf;
+			msg.dwBufferCount	= 1;
+			msg.Control.buf		= achControl;
+			msg.Control.len		= sizeof(achControl);
+			if(lpfnWSARecvMsg(sock, &msg, &len, NULL, NULL) == SOCKET_ERROR) break;
+			// echo reply, time exceeded, destination unreachable
+			if(!len || (achRepData[0] != (char)129 && achRepData[0] != 3 && achRepData[0] != 1)) continue;
+			for(WSACMSGHDR* cmsg = WSA_CMSG_FIRSTHDR(&msg); cmsg; cmsg = WSA_CMSG_NXTHDR(&msg, cmsg)) {
+				if(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT)
+					ttl = *(int*)WSA_CMSG_DATA(cmsg);
+			}
+		} else {
+			int fromlen = sizeof(from);
+			int len = recvfrom(sock, achRepData, sizeof(achRepData), 0, (sockaddr*)&from, &fromlen);
+			if(len == SOCKET_ERROR) break;
+			int hlen = (achRepData[0] & 0x0f) * 4;
+			if(len <= hlen) continue;
+			switch(achRepData[hlen]) {
+			case ICMP_ECHOREPLY:
+			case ICMP_TIME_EXCEEDED:
+			case ICMP_HOST_UNREACHABLE:
+			case ICMP_TSTAMPREPLY:
+				ttl = (u_char)achRepData[8];
+			}
+		}
+		if(ttl > 0) wmtrnet->UpdateReplyTTL((sockaddr*)&from, ttl);
+	}
+	closesocket(sock);
+	TRACE_MSG("Listener thread stopped.");
+	delete p;
+	return 0;
+}
+
+inline bool WinMTRNet::HasAddr(int at)
 {
-	return (sockaddr*)&host[at].addr;
+	return stats[at].has_addr.load(std::memory_order_acquire);
+}
+
+inline unsigned WinMTRNet::AddrId(int at)
+{
+	return HasAddr(at) ? host[at].addr_id : 0;
+}
+
+const sockaddr* WinMTRNet::GetAddr(int at)
+{
+	return addresses.Get(AddrId(at));
 }
 
 int WinMTRNet::GetName(int at, char* n)
@@ -299,110 +874,328 @@ int WinMTRNet::GetName(int at, char* n)
 	return 0;
 }
 
-int WinMTRNet::GetBest(int at)
+//*****************************************************************************
+// WinMTRNet::ReadCounters
+//
+// Consistent copy of the counters of one hop (name and address excluded). A
+// group with a reset pending reads as zeroed, see ResetStats.
+//*****************************************************************************
+void WinMTRNet::ReadCounters(int at, s_hopsnapshot* snap)
+{
+	s_hopstats& s = stats[at];
+	unsigned seq;
+	unsigned long long xmit, returned, total, hist[HIST_BUCKETS];
+	bool pending;
+	do {
+		seq = ReadBegin(s.seq);
+		pending = s.reset_req.load(std::memory_order_relaxed) != s.epoch.load(std::memory_order_relaxed);
+		s.echo.Read(&xmit, &returned, &total, &snap->last, &snap->best, &snap->worst);
+		double mean;
+		s.rtt_stats.Read(&mean, &snap->stddev, &snap->jitter);
+		for(int w = 0; w < NR_WINDOWS; ++w)
+			s.windows[w].Read(&snap->window[w].xmit, &snap->window[w].returned, &snap->window[w].avg);
+		s.loss.Read(&snap->loss);
+		s.rtt_hist.Read(hist);
+	} while(ReadRetry(s.seq, seq));
+	snap->xmit = xmit;
+	snap->returned = returned;
+	snap->deviation = s.deviation.load(std::memory_order_relaxed);
+	snap->abnormal = s.abnormal.load(std::memory_order_relaxed);
+	if(pending) {
+		snap->xmit = snap->returned = 0;
+		total = 0;
+		snap->last = snap->best = snap->worst = 0;
+		snap->stddev = snap->jitter = 0;
+		memset(snap->window, 0, sizeof(snap->window));
+		memset(&snap->loss, 0, sizeof(snap->loss));
+		memset(hist, 0, sizeof(hist));
+		snap->deviation = INT_MIN;
+		snap->abnormal = false;
+	}
+	for(int w = 0; w < NR_WINDOWS; ++w)
+		snap->window[w].percent = (snap->window[w].xmit == 0) ? 0 : (int)(100 - (100 * snap->window[w].returned / snap->window[w].xmit));
+	snap->avg = FixedAvg(total, snap->returned);
+	snap->percent = (snap->xmit == 0) ? 0 : (int)(100 - (100 * snap->returned / snap->xmit));
+	static const int pct[4] = { 50, 90, 95, 99 };
+	int pval[4];
+	LatencyHistogram::Percentiles(hist, pct, 4, pval);
+	snap->p50 = pval[0];
+	snap->p90 = pval[1];
+	snap->p95 = pval[2];
+	snap->p99 = pval[3];
+
+	long long ts_returned, ts_fwd_total, ts_ret_total;
+	int ts_offset;
+	do {
+		seq = ReadBegin(s.ts_seq);
+		pending = s.reset_req.load(std::memory_order_relaxed) != s.ts_epoch.load(std::memory_order_relaxed);
+		ts_returned = s.ts_returned.load(std::memory_order_relaxed);
+		ts_fwd_total = s.ts_fwd_total.load(std::memory_order_relaxed);
+		ts_ret_total = s.ts_ret_total.load(std::memory_order_relaxed);
+		ts_offset = s.ts_offset.load(std::memory_order_relaxed);
+	} while(ReadRetry(s.ts_seq, seq));
+	snap->oneway = !pending && ts_returned != 0;
+	snap->fwd = snap->oneway ? (int)(ts_fwd_total / ts_returned) - ts_offset : 0;
+	snap->ret = snap->oneway ? (int)(ts_ret_total / ts_returned) + ts_offset : 0;
+
+	snap->rhops = ReturnHops(at, s.reply_ttl.load(std::memory_order_relaxed), &snap->asymmetric);
+}
+
+//*****************************************************************************
+// WinMTRNet::GetSnapshot
+//
+// Consistent copy of every hop of the path, for display, export and logging.
+// Takes ghMutex once for all names; returns the number of hops.
+//*****************************************************************************
+int WinMTRNet::GetSnapshot(std::vector<s_hopsnapshot>& hops)
 {
+	int nh = GetMax();
+	hops.resize(nh);
 	WaitForSingleObject(ghMutex, INFINITE);
-	int ret = host[at].best;
+	for(int at = 0; at < nh; ++at) {
+		hops[at].addr_id = host[at].addr_id;
+		memcpy(&hops[at].addr6, addresses.Get(host[at].addr_id), sizeof(sockaddr_in6));
+		strcpy(hops[at].name, host[at].name);
+	}
 	ReleaseMutex(ghMutex);
-	return ret;
+	for(int at = 0; at < nh; ++at)
+		ReadCounters(at, &hops[at]);
+	return nh;
 }
 
-int WinMTRNet::GetWorst(int at)
+//*****************************************************************************
+// WinMTRNet::GetDestination
+//
+// Counters of the last hop; a trace without hops yet reads as 100% loss.
+// Returns the number of hops.
+//*****************************************************************************
+int WinMTRNet::GetDestination(s_hopsnapshot* dest)
 {
+	int nh = GetMax();
+	if(nh) {
+		ReadCounters(nh - 1, dest);
+	} else {
+		memset(dest, 0, sizeof(*dest));
+		dest->percent = 100;
+	}
+	return nh;
+}
+
+//*****************************************************************************
+// WinMTRNet::GetSamples
+//
+// The recent samples of a hop, oldest first. The ring is copied without
+// locking, then the slots the probe thread reused meanwhile are dropped.
+//*****************************************************************************
+int WinMTRNet::GetSamples(int at, std::vector<s_sample>& samples)
+{
+	s_hopstats& s = stats[at];
+	unsigned head = s.sample_head.load(std::memory_order_acquire);
+	unsigned n = head < SAVED_PINGS ? head : SAVED_PINGS;
+	samples.resize(n);
+	for(unsigned i = 0; i < n; ++i) {
+		s_sampleslot& slot = s.samples[(head - n + i) % SAVED_PINGS];
+		s_sample& sample = samples[i];
+		sample.time = slot.time.load(std::memory_order_relaxed);
+		sample.rtt = slot.rtt.load(std::memory_order_relaxed);
+		sample.addr_id = slot.addr_id.load(std::memory_order_relaxed);
+		sample.round = slot.round.load(std::memory_order_relaxed);
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	unsigned overwritten = s.sample_head.load(std::memory_order_relaxed) + 1 - SAVED_PINGS;// oldest sample index not reused yet
+	unsigned drop = (int)(overwritten - (head - n)) > 0 ? overwritten - (head - n) : 0;
+	if(drop > n) drop = n;
+	samples.erase(samples.begin(), samples.begin() + drop);
+	for(size_t i = 0; i < samples.size(); ++i)// ids torn by a reused slot were dropped above
+		memcpy(&samples[i].addr6, addresses.Get(samples[i].addr_id), sizeof(sockaddr_in6));
+	return (int)samples.size();
+}
+
+//*****************************************************************************
+// WinMTRNet::GetEvents
+//
+// Hands over the change points detected since the last call
+//*****************************************************************************
+int WinMTRNet::GetEvents(std::vector<s_hopevent>& out)
+{
+	out.clear();
 	WaitForSingleObject(ghMutex, INFINITE);
-	int ret = host[at].worst;
+	out.swap(events);
 	ReleaseMutex(ghMutex);
-	return ret;
+	return (int)out.size();
+}
+
+//*****************************************************************************
+// WinMTRNet::GetSummary
+//
+// Mergeable statistics of one hop, see HopSummary; zeroed while a reset is
+// pending
+//*****************************************************************************
+void WinMTRNet::GetSummary(int at, HopSummary* sum)
+{
+	s_hopstats& s = stats[at];
+	unsigned seq;
+	bool pending;
+	do {
+		seq = ReadBegin(s.seq);
+		pending = s.reset_req.load(std::memory_order_relaxed) != s.epoch.load(std::memory_order_relaxed);
+		int last;
+		s.echo.Read(&sum->xmit, &sum->returned, &sum->total, &last, &sum->best, &sum->worst);
+		s.rtt_stats.ReadMoments(&sum->n, &sum->mean, &sum->m2);
+		s.rtt_hist.Read(sum->hist);
+	} while(ReadRetry(s.seq, seq));
+	if(pending) sum->Clear();
+}
+
+//*****************************************************************************
+// WinMTRNet::GetHistory
+//
+// Every probe of a hop since the trace started, oldest first
+//*****************************************************************************
+int WinMTRNet::GetHistory(int at, std::vector<HistoryPoint>& points)
+{
+	return stats[at].history.Decode(points);
+}
+
+void WinMTRNet::GetHistorySize(int at, unsigned long long* samples, unsigned long long* bytes)
+{
+	*samples = stats[at].history.Samples();
+	*bytes = stats[at].history.Bytes();
+}
+
+int WinMTRNet::GetBest(int at)
+{
+	s_hopsnapshot snap;
+	ReadCounters(at, &snap);
+	return snap.best;
+}
+
+int WinMTRNet::GetWorst(int at)
+{
+	s_hopsnapshot snap;
+	ReadCounters(at, &snap);
+	return snap.worst;
 }
 
 int WinMTRNet::GetAvg(int at)
 {
-	WaitForSingleObject(ghMutex, INFINITE);
-	int ret = host[at].returned == 0 ? 0 : host[at].total / host[at].returned;
-	ReleaseMutex(ghMutex);
-	return ret;
+	s_hopsnapshot snap;
+	ReadCounters(at, &snap);
+	return snap.avg;
 }
 
 int WinMTRNet::GetPercent(int at)
 {
-	WaitForSingleObject(ghMutex, INFINITE);
-	int ret = (host[at].xmit == 0) ? 0 : (100 - (100 * host[at].returned / host[at].xmit));
-	ReleaseMutex(ghMutex);
-	return ret;
+	s_hopsnapshot snap;
+	ReadCounters(at, &snap);
+	return snap.percent;
 }
 
 int WinMTRNet::GetLast(int at)
 {
-	WaitForSingleObject(ghMutex, INFINITE);
-	int ret = host[at].last;
-	ReleaseMutex(ghMutex);
-	return ret;
+	s_hopsnapshot snap;
+	ReadCounters(at, &snap);
+	return snap.last;
 }
 
-int WinMTRNet::GetReturned(int at)
+long long WinMTRNet::GetReturned(int at)
 {
-	WaitForSingleObject(ghMutex, INFINITE);
-	int ret = host[at].returned;
-	ReleaseMutex(ghMutex);
-	return ret;
+	s_hopsnapshot snap;
+	ReadCounters(at, &snap);
+	return snap.returned;
 }
 
-int WinMTRNet::GetXmit(int at)
+long long WinMTRNet::GetXmit(int at)
 {
-	WaitForSingleObject(ghMutex, INFINITE);
-	int ret = host[at].xmit;
-	ReleaseMutex(ghMutex);
-	return ret;
+	s_hopsnapshot snap;
+	ReadCounters(at, &snap);
+	return snap.xmit;
+}
+
+bool WinMTRNet::GetOneWay(int at, int* fwd, int* ret)
+{
+	s_hopsnapshot snap;
+	ReadCounters(at, &snap);
+	*fwd = snap.fwd;
+	*ret = snap.ret;
+	return snap.oneway;
+}
+
+int WinMTRNet::GetReturnHops(int at, bool* asymmetric)
+{
+	return ReturnHops(at, stats[at].reply_ttl.load(std::memory_order_relaxed), asymmetric);
+}
+
+//*****************************************************************************
+// WinMTRNet::ReturnHops
+//
+// Reply TTLs start at one of the common initial values (32, 64, 128 or 255),
+// so the closest one above the received TTL gives the return path length.
+// A hop at TTL n answering over a path of the same length reads back n.
+//*****************************************************************************
+int WinMTRNet::ReturnHops(int at, int ttl, bool* asymmetric)
+{
+	if(!ttl) {
+		*asymmetric = false;
+		return 0;
+	}
+	int initial = ttl <= 32 ? 32 : ttl <= 64 ? 64 : ttl <= 128 ? 128 : 255;
+	int hops = initial - ttl + 1;
+	*asymmetric = abs(hops - (at + 1)) >= ASYMMETRY_HOPS;
+	return hops;
 }
 
 int WinMTRNet::GetMax()
 {
 	// @todo : improve this (last hop guess)
-	WaitForSingleObject(ghMutex, INFINITE);
 	int max=0;//first try to find target, if not found, find best guess (doesn't work actually :P)
-	if(host[0].addr6.sin6_family==AF_INET6) {
-		for(; max<MAX_HOPS && memcmp(&host[max++].addr6.sin6_addr,&last_remote_addr6,sizeof(in6_addr)););
-		if(max==MAX_HOPS) {
-			while(max>1 && !memcmp(&host[max-1].addr6.sin6_addr,&host[max-2].addr6.sin6_addr,sizeof(in6_addr)) && (host[max-1].addr6.sin6_addr.u.Word[0]|host[max-1].addr6.sin6_addr.u.Word[1]|host[max-1].addr6.sin6_addr.u.Word[2]|host[max-1].addr6.sin6_addr.u.Word[3]|host[max-1].addr6.sin6_addr.u.Word[4]|host[max-1].addr6.sin6_addr.u.Word[5]|host[max-1].addr6.sin6_addr.u.Word[6]|host[max-1].addr6.sin6_addr.u.Word[7])) --max;
-		}
-	} else {
-		for(; max<MAX_HOPS && host[max++].addr.sin_addr.s_addr!=last_remote_addr.s_addr;);
-		if(max==MAX_HOPS) {
-			while(max>1 && host[max-1].addr.sin_addr.s_addr==host[max-2].addr.sin_addr.s_addr && host[max-1].addr.sin_addr.s_addr) --max;
-		}
+	for(; max<MAX_HOPS && AddrId(max++)!=target_id;);
+	if(max==MAX_HOPS) {
+		while(max>1 && AddrId(max-1)==AddrId(max-2) && AddrId(max-1)) --max;
 	}
-	ReleaseMutex(ghMutex);
 	return max;
 }
 
 void WinMTRNet::SetAddr(int at, u_long addr)
 {
+	if(HasAddr(at)) return;// the first address of a hop sticks
 	WaitForSingleObject(ghMutex, INFINITE);
-	if(host[at].addr.sin_addr.s_addr==0) {
-		TRACE_MSG("Start DnsResolverThread for new address " << addr << ". Old addr value was " << host[at].addr.sin_addr.s_addr);
-		host[at].addr.sin_family=AF_INET;
-		host[at].addr.sin_addr.s_addr=addr;
+	if(!HasAddr(at)) {
+		sockaddr_in sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family=AF_INET;
+		sa.sin_addr.s_addr=addr;
+		host[at].addr_id=addresses.Intern((sockaddr*)&sa);
+		TRACE_MSG("Start DnsResolverThread for new address " << addr << ", id " << host[at].addr_id);
+		stats[at].has_addr.store(true, std::memory_order_release);
 		dns_resolver_thread* dnt=new dns_resolver_thread;
 		dnt->index=at;
 		dnt->winmtr=this;
-		if(wmtrdlg->useDNS) _beginthread(DnsResolverThread, 0, dnt);
-		else DnsResolverThread(dnt);
+		dnt->resolve=wmtrdlg->useDNS != FALSE;
+		AddRef();
+		if(!dnt->resolve || _beginthread(DnsResolverThread, 0, dnt) == (uintptr_t)-1L) DnsResolverThread(dnt);
 	}
 	ReleaseMutex(ghMutex);
 }
 
 void WinMTRNet::SetAddr6(int at, IPV6_ADDRESS_EX addrex)
 {
+	if(HasAddr(at)) return;// the first address of a hop sticks
 	WaitForSingleObject(ghMutex, INFINITE);
-	if(!(host[at].addr6.sin6_addr.u.Word[0]|host[at].addr6.sin6_addr.u.Word[1]|host[at].addr6.sin6_addr.u.Word[2]|host[at].addr6.sin6_addr.u.Word[3]|host[at].addr6.sin6_addr.u.Word[4]|host[at].addr6.sin6_addr.u.Word[5]|host[at].addr6.sin6_addr.u.Word[6]|host[at].addr6.sin6_addr.u.Word[7])) {
-		TRACE_MSG("Start DnsResolverThread for new address " << addrex.sin6_addr[0] << ". Old addr value was " << host[at].addr6.sin6_addr.u.Word[0]);
-		host[at].addr6.sin6_family=AF_INET6;
-		host[at].addr6.sin6_addr=*(in6_addr*)&addrex.sin6_addr;
+	if(!HasAddr(at)) {
+		sockaddr_in6 sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sin6_family=AF_INET6;
+		sa.sin6_addr=*(in6_addr*)&addrex.sin6_addr;
+		host[at].addr_id=addresses.Intern((sockaddr*)&sa);
+		TRACE_MSG("Start DnsResolverThread for new address " << addrex.sin6_addr[0] << ", id " << host[at].addr_id);
+		stats[at].has_addr.store(true, std::memory_order_release);
 		dns_resolver_thread* dnt=new dns_resolver_thread;
 		dnt->index=at;
 		dnt->winmtr=this;
-		if(wmtrdlg->useDNS) _beginthread(DnsResolverThread,0,dnt);
-		else DnsResolverThread(dnt);
+		dnt->resolve=wmtrdlg->useDNS != FALSE;
+		AddRef();
+		if(!dnt->resolve || _beginthread(DnsResolverThread, 0, dnt) == (uintptr_t)-1L) DnsResolverThread(dnt);
 	}
 	ReleaseMutex(ghMutex);
 }
@@ -411,7 +1204,9 @@ void WinMTRNet::SetName(int at, char* n)
 {
 	WaitForSingleObject(ghMutex, INFINITE);
 	strcpy(host[at].name, n);
+	stats[at].has_name.store(true, std::memory_order_release);
 	ReleaseMutex(ghMutex);
+	topology.SetName(AddrId(at), n);
 }
 
 void WinMTRNet::SetErrorName(int at, DWORD errnum)
@@ -458,38 +1253,439 @@ void WinMTRNet::SetErrorName(int at, DWORD errnum)
 		TRACE_MSG("==UNKNOWN ERROR== " << errnum);
 		name="Unknown error! (please report)"; break;
 	}
+	if(stats[at].has_name.load(std::memory_order_acquire)) return;// errors only name silent hops
 	WaitForSingleObject(ghMutex, INFINITE);
-	if(!*host[at].name)
+	if(!*host[at].name) {
 		strcpy(host[at].name,name);
+		stats[at].has_name.store(true, std::memory_order_release);
+	}
 	ReleaseMutex(ghMutex);
 }
 
-void WinMTRNet::UpdateRTT(int at, int rtt)
+void WinMTRNet::AddReply(int at, int rtt)
+{
+	s_hopstats& s = stats[at];
+	WriteBegin(s.seq);
+	s.echo.AddReply(rtt);
+	s.rtt_stats.Add(rtt);
+	s.rtt_hist.Add(rtt);
+	ULONGLONG now = Ticks();
+	for(int w=0; w<NR_WINDOWS; ++w) s.windows[w].AddReply(now, rtt);
+	s.loss.Add(false);
+	WriteEnd(s.seq);
+}
+
+static long long UnixTimeMs()
+{
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	return (long long)(((((ULONGLONG)ft.dwHighDateTime) << 32) | ft.dwLowDateTime) - 116444736000000000ULL) / 10000;
+}
+
+// monotonic ms for windows, alerts and rates: the virtual clock while replaying
+inline ULONGLONG WinMTRNet::Ticks()
+{
+	return vclock ? (ULONGLONG)vclock : GetTickCount64();
+}
+
+// Unix time in ms, the virtual clock while replaying
+inline long long WinMTRNet::Now()
+{
+	return vclock ? vclock : UnixTimeMs();
+}
+
+//*****************************************************************************
+// WinMTRNet::AddSample
+//
+// Probe thread of the hop only, once per probe. The release fence orders
+// the previous sample_head store before the slot is reused, see GetSamples.
+// Also feeds the topology graph with the link from the last responder of
+// the nearest answering hop before this one (or this host), the baseline
+// scoring, the alert rules and the probe rate; hops that never answered are
+// left out. Probes of a round (round > 0) also land in its cell of the
+// round table, with a spike flag; a spike of the destination waits there
+// for the rest of its round, see CloseRounds.
+//*****************************************************************************
+void WinMTRNet::AddSample(int at, int rtt, const sockaddr* from, unsigned round)
+{
+	AddProbe(at, rtt, addresses.Intern(from), round);
+}
+
+// AddSample with the responder interned, also the way in of replayed probes
+void WinMTRNet::AddProbe(int at, int rtt, unsigned id, unsigned round)
 {
+	s_hopstats& s = stats[at];
+	long long now_ms = Now();
+	if(probeLog) probeLog->Write(probeTrace, now_ms, at, id, rtt, round);
+	if(rtt < 0) {// settles the lost probe; a reply was counted by AddReply, with returned
+		WriteBegin(s.seq);
+		s.loss.Add(true);
+		WriteEnd(s.seq);
+	}
+	s.history.Add(now_ms, rtt);
+	bool settling = s.changes.Settling();
+	int kind, before, after;
+	if((kind = s.changes.Add(rtt, &before, &after)) != CHANGE_NONE)
+		AddEvent(at, kind, before, after);
+	unsigned head = s.sample_head.load(std::memory_order_relaxed);
+	s_sampleslot& slot = s.samples[head % SAVED_PINGS];
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.time.store(Ticks(), std::memory_order_relaxed);
+	slot.rtt.store(rtt, std::memory_order_relaxed);
+	slot.addr_id.store(id, std::memory_order_relaxed);
+	slot.round.store(round, std::memory_order_relaxed);
+	s.sample_head.store(head + 1, std::memory_order_release);
+
+	bool spike = s.spikes.Add(rtt);
+	if(round) {
+		rounds[(round % ROUND_SLOTS) * MAX_HOPS + at].store((unsigned long long)round << 32 | (spike ? ROUND_SPIKE : 0) | (unsigned)(rtt + 1), std::memory_order_relaxed);
+		if(spike && id && id == target_id) {
+			s_spike sp = { round, at, rtt, s.spikes.Level(), Ticks() };
+			WaitForSingleObject(ghMutex, INFINITE);
+			if(spikes.size() < MAX_EVENTS) spikes.push_back(sp);
+			ReleaseMutex(ghMutex);
+		}
+	}
+
+	if(!id) id = AddrId(at);// lost probe: the usual responder of the hop
+	if(!id) return;
+	int near_at = at - 1;
+	unsigned near_id = 0;
+	for(; near_at >= 0 && !(near_id = LastResponder(near_at)); --near_at);
+	int near_rtt = 0;
+	if(near_at >= 0) {// counters of another probe thread
+		s_hopstats& n = stats[near_at];
+		unsigned seq;
+		do {
+			seq = ReadBegin(n.seq);
+			near_rtt = n.returned.load(std::memory_order_relaxed) ? n.last.load(std::memory_order_relaxed) : -1;
+		} while(ReadRetry(n.seq, seq));
+	}
+	bool abnormal = s.dev_abnormal;
+	if(!vclock) {// the graph and the baselines are the process' own, replays leave them alone
+		if(near_id != id) topology.Add(near_id, id, target_id, rtt, near_rtt);
+		ScoreSample(at, id, rtt);
+	}
+
+	s_alertchange changes[ALERT_MAX_RULES];
+	ULONGLONG now = Ticks();
+	int nc = s.alert.Update(wmtrdlg->alertRules, rtt, id == target_id, now, changes);
+	bool trouble = kind == CHANGE_LOSS_ONSET || (!settling && s.changes.Settling()) || (!abnormal && s.dev_abnormal);
+	for(int c = 0; c < nc; ++c) {
+		AddEvent(at, changes[c].raised ? CHANGE_ALERT_RAISED : CHANGE_ALERT_CLEARED, changes[c].rule, changes[c].value);
+		if(changes[c].raised) trouble = true;
+	}
+	bool lasting = s.changes.Lossy() || s.changes.Settling() || s.dev_abnormal || s.alert.Raised();
+	s.rate.Update(trouble, lasting, (unsigned)(wmtrdlg->interval * 1000), (unsigned)(wmtrdlg->minInterval * 1000), now);
+}
+
+//*****************************************************************************
+// WinMTRNet::WaitProbe
+//
+// Probe thread of the hop, before each probe. Probes go out in numbered
+// rounds, one every interval, all TTLs at the start of the round, so the
+// replies of a round can be compared hop by hop. A hop in a hurry (see
+// ProbeRate) also probes between rounds. Returns the round of the probe,
+// 0 between rounds or when the trace stops; *round is the last round the
+// thread probed, *sent when it last probed.
+//*****************************************************************************
+unsigned WinMTRNet::WaitProbe(int at, unsigned* last, ULONGLONG* sent)
+{
+	while(tracing) {
+		ULONGLONG now = GetTickCount64();
+		unsigned r = OpenRound(now);
+		if(r != *last) {
+			*last = r;
+			*sent = now;
+			return r;
+		}
+		DWORD base = (DWORD)(wmtrdlg->interval * 1000), hurry = ProbeInterval(at);
+		ULONGLONG wake = round_due.load(std::memory_order_acquire);
+		if(hurry < base) {
+			if(now >= *sent + hurry) {
+				*sent = now;
+				return 0;
+			}
+			if(*sent + hurry < wake) wake = *sent + hurry;
+		}
+		Sleep(wake > now ? (DWORD)(wake - now) : 1);
+	}
+	return 0;
+}
+
+//*****************************************************************************
+// WinMTRNet::OpenRound
+//
+// Number of the current round, opening the next one when it is due. Rounds
+// keep their cadence, and restart from now after a stall.
+//*****************************************************************************
+unsigned WinMTRNet::OpenRound(ULONGLONG now)
+{
+	if(now < round_due.load(std::memory_order_acquire)) return cur_round.load(std::memory_order_relaxed);
 	WaitForSingleObject(ghMutex, INFINITE);
-	host[at].last=rtt;
-	host[at].total+=rtt;
-	if(host[at].best>rtt || host[at].xmit==1)
-		host[at].best=rtt;
-	if(host[at].worst<rtt)
-		host[at].worst=rtt;
+	ULONGLONG due = round_due.load(std::memory_order_relaxed);
+	bool opened = now >= due;
+	if(opened) {
+		ULONGLONG period = (ULONGLONG)(wmtrdlg->interval * 1000);
+		if(!period) period = 1;
+		due += period;
+		if(due <= now) due = now + period;
+		cur_round.store(cur_round.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		round_due.store(due, std::memory_order_release);
+	}
+	unsigned r = cur_round.load(std::memory_order_relaxed);
 	ReleaseMutex(ghMutex);
+	if(opened) CloseRounds(now);
+	return r;
 }
 
-void WinMTRNet::AddReturned(int at)
+//*****************************************************************************
+// WinMTRNet::CloseRounds
+//
+// Attributes the destination spikes whose round has settled (every probe
+// of it answered or timed out): one CHANGE_SPIKE event at the first hop
+// showing the spike, with the usual and the spike RTT of the destination
+//*****************************************************************************
+void WinMTRNet::CloseRounds(ULONGLONG now)
 {
+	std::vector<s_spike> settled;
 	WaitForSingleObject(ghMutex, INFINITE);
-	++host[at].returned;
+	for(size_t i = 0; i < spikes.size();) {
+		if(now - spikes[i].time < ECHO_REPLY_TIMEOUT) {
+			++i;
+			continue;
+		}
+		settled.push_back(spikes[i]);
+		spikes.erase(spikes.begin() + i);
+	}
 	ReleaseMutex(ghMutex);
+	for(size_t i = 0; i < settled.size(); ++i)
+		AddEvent(SpikeOrigin(settled[i].round, settled[i].hop), CHANGE_SPIKE, settled[i].level, settled[i].rtt);
 }
 
-void WinMTRNet::AddXmit(int at)
+//*****************************************************************************
+// WinMTRNet::SpikeOrigin
+//
+// First hop of the unbroken run of spiking hops that ends at the destination
+// in a round. Hops without a reply in the round don't break the run, one
+// that answered without a spike does.
+//*****************************************************************************
+int WinMTRNet::SpikeOrigin(unsigned r, int dest)
 {
+	std::atomic<unsigned long long>* cells = rounds + (r % ROUND_SLOTS) * MAX_HOPS;
+	int first = dest;
+	for(int at = dest - 1; at >= 0; --at) {
+		unsigned long long c = cells[at].load(std::memory_order_relaxed);
+		if((unsigned)(c >> 32) != r || !(c & ~ROUND_SPIKE)) continue;// lost, or no reply yet when the slot was reused
+		if(!(c & ROUND_SPIKE)) break;
+		first = at;
+	}
+	return first;
+}
+
+//*****************************************************************************
+// WinMTRNet::StartReplay
+//
+// Replays a recorded trace in virtual time (see ReplayProbeLog): the probes
+// go through the same accounting as live ones, as fast as they are fed,
+// with the clock set from their timestamps. SetTarget first; no probe
+// thread may run on this instance.
+//*****************************************************************************
+void WinMTRNet::StartReplay()
+{
+	ResetHops();
+	target_id = addresses.Intern(&target);
+	vclock = 0;
+}
+
+//*****************************************************************************
+// WinMTRNet::ReplayProbe
+//
+// One recorded probe (rtt -1: lost, id: responder, 0 if unknown), in the
+// order of the log. False if the hop is out of range.
+//*****************************************************************************
+bool WinMTRNet::ReplayProbe(long long time, int at, int rtt, unsigned id, unsigned round)
+{
+	if(at < 0 || at >= MAX_HOPS) return false;
+	vclock = time > 0 ? time : 1;
+	if(round > cur_round.load(std::memory_order_relaxed)) {
+		cur_round.store(round, std::memory_order_relaxed);
+		CloseRounds(vclock);
+	}
+	AddXmit(at);
+	if(rtt >= 0) AddReply(at, rtt);
+	AddProbe(at, rtt, id, round);
+	if(rtt >= 0 && id && !HasAddr(at)) {// as SetAddr, without name resolution
+		WaitForSingleObject(ghMutex, INFINITE);
+		host[at].addr_id = id;
+		stats[at].has_addr.store(true, std::memory_order_release);
+		ReleaseMutex(ghMutex);
+	}
+	return true;
+}
+
+// Attributes the spikes still waiting for their round
+void WinMTRNet::EndReplay()
+{
+	if(vclock) CloseRounds(vclock + ECHO_REPLY_TIMEOUT);
+}
+
+//*****************************************************************************
+// WinMTRNet::ProbeInterval
+//
+// ms to the next probe of a hop: the configured interval, shorter while the
+// hop is in trouble, see ProbeRate
+//*****************************************************************************
+DWORD WinMTRNet::ProbeInterval(int at)
+{
+	return stats[at].rate.Interval((unsigned)(wmtrdlg->interval * 1000), (unsigned)(wmtrdlg->minInterval * 1000));
+}
+
+//*****************************************************************************
+// WinMTRNet::ScoreSample
+//
+// Probe thread of the hop only. Distance of the probe to the baseline of
+// (target, responder) in p50 -> p90 spreads, clipped and smoothed over ~16
+// probes, next to the smoothed loss rate. The hop turns abnormal when
+// either goes well past the baseline and back to normal with hysteresis;
+// both transitions are events.
+//*****************************************************************************
+void WinMTRNet::ScoreSample(int at, unsigned responder, int rtt)
+{
+	s_hopstats& s = stats[at];
+	if(!s.baseline || s.baseline_id != responder) {
+		s.baseline = baselines.Get(target_id, responder);
+		s.baseline_id = responder;
+	}
+	s_baselineref ref;
+	if(!baselines.Score(s.baseline, rtt, &ref)) return;// too young to judge
+
+	const double alpha = 1.0 / (1 << BASELINE_EWMA_SHIFT);
+	s.dev_loss += ((rtt < 0 ? 1.0 : 0.0) - s.dev_loss) * alpha;
+	if(rtt >= 0) {
+		double z = (double)(rtt - ref.p50) / ref.spread;
+		if(z > BASELINE_CLIP) z = BASELINE_CLIP;
+		else if(z < -BASELINE_CLIP) z = -BASELINE_CLIP;
+		s.dev_score += (z - s.dev_score) * alpha;
+	}
+	int level = ref.p50 + (int)(s.dev_score * ref.spread + 0.5);
+	bool slow = s.dev_score >= (s.dev_abnormal ? BASELINE_NORMAL : BASELINE_ABNORMAL);
+	bool lossy = s.dev_loss >= ref.loss + (s.dev_abnormal ? BASELINE_LOSS_MARGIN / 2 : BASELINE_LOSS_MARGIN);
+	if(!s.dev_abnormal && (slow || lossy)) {
+		s.dev_abnormal = true;
+		if(slow) AddEvent(at, CHANGE_BASELINE_SLOW, ref.p50, level);
+		else AddEvent(at, CHANGE_BASELINE_LOSS, (int)(ref.loss * 100 + 0.5), (int)(s.dev_loss * 100 + 0.5));
+	} else if(s.dev_abnormal && !slow && !lossy) {
+		s.dev_abnormal = false;
+		AddEvent(at, CHANGE_BASELINE_NORMAL, ref.p50, level);
+	}
+	s.deviation.store((int)(s.dev_score * 10 + (s.dev_score < 0 ? -0.5 : 0.5)), std::memory_order_relaxed);
+	s.abnormal.store(s.dev_abnormal, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// WinMTRNet::AddEvent
+//
+// Queues an event of a hop for the dialog, see GetEvents
+//*****************************************************************************
+void WinMTRNet::AddEvent(int at, int kind, int before, int after)
+{
+	s_hopevent ev;
+	ev.time = vclock ? (time_t)(vclock / 1000) : time(NULL);
+	ev.hop = at;
+	ev.kind = kind;
+	ev.before = before;
+	ev.after = after;
 	WaitForSingleObject(ghMutex, INFINITE);
-	++host[at].xmit;
+	if(events.size() < MAX_EVENTS) events.push_back(ev);
 	ReleaseMutex(ghMutex);
 }
 
+//*****************************************************************************
+// WinMTRNet::LastResponder
+//
+// Address that answered the last probe of a hop, else the first one seen;
+// 0 for a silent hop
+//*****************************************************************************
+unsigned WinMTRNet::LastResponder(int at)
+{
+	s_hopstats& s = stats[at];
+	unsigned head = s.sample_head.load(std::memory_order_acquire);
+	unsigned id = head ? s.samples[(head - 1) % SAVED_PINGS].addr_id.load(std::memory_order_relaxed) : 0;
+	return id ? id : AddrId(at);
+}
+
+void WinMTRNet::AddXmit(int at)
+{
+	s_hopstats& s = stats[at];
+	WriteBegin(s.seq);
+	unsigned req = s.reset_req.load(std::memory_order_acquire);
+	if(req != s.epoch.load(std::memory_order_relaxed)) {
+		ResetEcho(s);
+		s.epoch.store(req, std::memory_order_relaxed);
+	}
+	s.echo.AddSent();
+	ULONGLONG now = Ticks();
+	for(int w=0; w<NR_WINDOWS; ++w) s.windows[w].AddSent(now);
+	WriteEnd(s.seq);
+}
+
+void WinMTRNet::AddTimestampXmit(int at)
+{
+	s_hopstats& s = stats[at];
+	WriteBegin(s.ts_seq);
+	unsigned req = s.reset_req.load(std::memory_order_acquire);
+	if(req != s.ts_epoch.load(std::memory_order_relaxed)) {
+		ResetTimestamp(s);
+		s.ts_epoch.store(req, std::memory_order_relaxed);
+	}
+	WriterAdd(s.ts_xmit, 1ULL);
+	WriteEnd(s.ts_seq);
+}
+
+//*****************************************************************************
+// WinMTRNet::UpdateTimestamp
+//
+// The raw forward delta (receive - originate) and return delta (arrival -
+// transmit) both contain the remote clock offset, with opposite signs. The
+// offset is taken from the lowest-delay reply of each window, where queueing
+// is least likely, so one-way delays read as raw delta -/+ offset. Windows keep
+// the estimate following slow clock drift.
+//*****************************************************************************
+void WinMTRNet::UpdateTimestamp(int at, u_long originate, u_long receive, u_long transmit, int rtt)
+{
+	if((receive|transmit) & TSTAMP_NONSTANDARD) return;
+	int fwd = TimestampDiff(receive, originate);
+	int ret = TimestampDiff(originate + rtt, transmit);
+	int net = fwd + ret;// round trip minus remote processing time
+	int offset = (fwd - ret) / 2;
+	s_hopstats& s = stats[at];// window state is private to the hop's timestamp thread
+	WriteBegin(s.ts_seq);
+	WriterAdd(s.ts_fwd_total, (long long)fwd);
+	WriterAdd(s.ts_ret_total, (long long)ret);
+	if(!s.ts_win_count++ || net < s.ts_win_best) {
+		s.ts_win_best = net;
+		s.ts_win_offset = offset;
+	}
+	if(s.ts_returned.load(std::memory_order_relaxed) < TSTAMP_OFFSET_WINDOW || s.ts_win_count == TSTAMP_OFFSET_WINDOW)
+		s.ts_offset.store(s.ts_win_offset, std::memory_order_relaxed);// the first window publishes as it goes
+	if(s.ts_win_count == TSTAMP_OFFSET_WINDOW)
+		s.ts_win_count = 0;
+	WriterAdd(s.ts_returned, 1ULL);
+	WriteEnd(s.ts_seq);
+}
+
+void WinMTRNet::UpdateReplyTTL(sockaddr* from, int ttl)
+{
+	unsigned id = addresses.Find(from);
+	if(!id) return;// not a hop address
+	for(int at = 0; at < MAX_HOPS; ++at) {
+		if(AddrId(at) != id) continue;
+		stats[at].reply_ttl.store((unsigned char)ttl, std::memory_order_relaxed);
+		break;
+	}
+}
+
 void DnsResolverThread(void* p)
 {
 	dns_resolver_thread* dnt=(dns_resolver_thread*)p;
@@ -498,14 +1694,15 @@ void DnsResolverThread(void* p)
 	if(!getnameinfo(wn->GetAddr(dnt->index),sizeof(sockaddr_in6),hostname,NI_MAXHOST,NULL,0,NI_NUMERICHOST)) {
 		wn->SetName(dnt->index,hostname);
 	}
-	if(wn->wmtrdlg->useDNS) {
+	if(dnt->resolve) {
 		TRACE_MSG("DNS resolver thread started.");
 		if(!getnameinfo(wn->GetAddr(dnt->index),sizeof(sockaddr_in6),hostname,NI_MAXHOST,NULL,0,0)) {
 			wn->SetName(dnt->index,hostname);
 		}
 		TRACE_MSG("DNS resolver thread stopped.");
 	}
-	delete p;
+	delete dnt;
+	wn->Release();
 }
 
 
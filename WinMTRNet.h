@@ -13,8 +13,11 @@
 #ifndef WINMTRNET_H_
 #define WINMTRNET_H_
 
+#include "WinMTRHop.h"
+#include <unordered_map>
 
 class WinMTRDialog;
+class ProbeLog;
 
 typedef IP_OPTION_INFORMATION IPINFO, *PIPINFO, FAR* LPIPINFO;
 #ifdef _WIN64
@@ -24,19 +27,118 @@ typedef ICMP_ECHO_REPLY ICMPECHO, *PICMPECHO, FAR* LPICMPECHO;
 #endif // _WIN64
 
 #define ECHO_REPLY_TIMEOUT 5000
+#define MAX_EVENTS 256		// change events kept until the dialog fetches them
+#define ADDR_CHUNK_BITS 8	// interned addresses are stored by chunks of 256
+#define ADDR_MAX_CHUNKS 4096	// up to 1M distinct addresses per process
+#define ROUND_SLOTS 128		// probe rounds kept aligned, see WinMTRNet::WaitProbe
+#define ROUND_SPIKE 0x80000000	// round cell flag: the probe was a spike at its hop
 
+//*****************************************************************************
+// CLASS:  AddressTable
+//
+// Every hop / responder address seen by the process, interned once. Hops,
+// samples and the target carry the 32-bit id, so comparing or hashing them
+// (and paths made of them) is integer work. Id 0 is the unknown address.
+// Entries never move nor change: Get needs no lock.
+//*****************************************************************************
+class AddressTable
+{
+public:
+	AddressTable();
+	~AddressTable();
+	unsigned Intern(const sockaddr* addr);	// id of addr, added if new; 0 for NULL / unspecified
+	unsigned Find(const sockaddr* addr);	// id of addr, 0 if never interned
+	const sockaddr* Get(unsigned id);		// sockaddr_in6 sized, all zero for id 0
+private:
+	struct Key {
+		unsigned long words[4];		// IPv4 in words[0]
+		unsigned short family;
+		bool operator==(const Key& k) const { return family == k.family && !memcmp(words, k.words, sizeof(words)); }
+	};
+	struct KeyHash {
+		size_t operator()(const Key& k) const;
+	};
+	static bool MakeKey(const sockaddr* addr, Key* key);
+	
+	SRWLOCK lock;					// ids, chunk allocation
+	std::unordered_map<Key, unsigned, KeyHash> ids;
+	unsigned count;					// ids given so far, 0 included
+	std::atomic<sockaddr_in6*> chunks[ADDR_MAX_CHUNKS];
+};
+
+extern AddressTable addresses;
+
+// Per-hop data written rarely, under ghMutex
 struct s_nethost {
+	unsigned addr_id;	// AddressTable id, final once has_addr is set
+	char name[255];
+};
+
+// One probe of a hop, see WinMTRNet::GetSamples
+struct s_sample {
+	ULONGLONG time;		// Ticks() when the probe completed: GetTickCount64(), the log's Unix time (ms) in a replay
+	int rtt;			// ms, -1 if no reply
+	unsigned addr_id;	// responder, AddressTable id (0 if unknown)
+	unsigned round;		// probe round, 0 if sent between rounds
+	union {				// responder, family 0 if unknown
+		sockaddr_in addr;
+		sockaddr_in6 addr6;
+	};
+};
+
+// Change point of one hop, see WinMTRNet::GetEvents
+struct s_hopevent {
+	time_t time;
+	int hop;			// 0 based
+	int kind;			// CHANGE_EVENTS
+	int before;			// see ChangeDetector::Add
+	int after;
+};
+
+// Destination spike waiting for the rest of its round, see WinMTRNet::CloseRounds
+struct s_spike {
+	unsigned round;
+	int hop;			// destination hop, 0 based
+	int rtt;			// of the spike
+	int level;			// usual RTT of the destination
+	ULONGLONG time;		// Ticks() when it was seen, see s_sample
+};
+
+// Consistent copy of one hop, see WinMTRNet::GetSnapshot
+struct s_hopsnapshot {
 	union {
 		sockaddr_in addr;
 		sockaddr_in6 addr6;
 	};
-	int xmit;			// number of PING packets sent
-	int returned;		// number of ICMP echo replies received
-	unsigned long total;	// total time
-	int last;				// last time
-	int best;				// best time
-	int worst;			// worst time
+	unsigned addr_id;	// AddressTable id, 0 if the hop didn't answer yet
 	char name[255];
+	long long xmit;
+	long long returned;
+	int best;
+	int avg;
+	int worst;
+	int last;
+	int percent;		// loss
+	int p50;			// RTT percentiles
+	int p90;
+	int p95;
+	int p99;
+	double stddev;		// RTT standard deviation
+	double jitter;		// RFC 3550 interarrival jitter of the RTTs
+	struct {
+		long long xmit;
+		long long returned;
+		int avg;
+		int percent;
+	} window[NR_WINDOWS];	// the same over the sliding windows of WINDOW_SECONDS
+	LossSummary loss;		// loss runs and Gilbert-Elliott model
+	int deviation;		// from the baseline, tenths of its p50 -> p90 spread, INT_MIN if none yet
+	bool abnormal;		// far from the baseline, see WinMTRNet::ScoreSample
+	bool oneway;		// fwd / ret are set (ICMP timestamp replies seen)
+	int fwd;			// one-way forward delay
+	int ret;			// one-way return delay
+	int rhops;			// return path length from the reply TTL, 0 if unknown
+	bool asymmetric;	// return path length differs from the forward one
 };
 
 //*****************************************************************************
@@ -61,34 +163,65 @@ public:
 
 	WinMTRNet(WinMTRDialog* wp);
 	~WinMTRNet();
+	void	AddRef();
+	void	Release();
 	void	DoTrace(sockaddr* sockaddr);
+	void	SetTarget(sockaddr* addr);
+	void	SetDscp(int dscp);
 	void	ResetHops();
+	void	ResetStats(int at);
+	void	ClaimWriter(int at, bool timestamp);
+	void	ReleaseWriter(int at, bool timestamp);
 	void	StopTrace();
 	
-	sockaddr* GetAddr(int at);
+	const sockaddr* GetAddr(int at);
 	int		GetName(int at, char* n);
 	int		GetBest(int at);
 	int		GetWorst(int at);
 	int		GetAvg(int at);
 	int		GetPercent(int at);
 	int		GetLast(int at);
-	int		GetReturned(int at);
-	int		GetXmit(int at);
+	long long	GetReturned(int at);
+	long long	GetXmit(int at);
+	bool	GetOneWay(int at, int* fwd, int* ret);
+	int		GetReturnHops(int at, bool* asymmetric);
 	int		GetMax();
+	int		GetSnapshot(std::vector<s_hopsnapshot>& hops);
+	int		GetDestination(s_hopsnapshot* dest);
+	int		GetSamples(int at, std::vector<s_sample>& samples);
+	int		GetEvents(std::vector<s_hopevent>& out);
+	int		GetHistory(int at, std::vector<HistoryPoint>& points);
+	void	GetHistorySize(int at, unsigned long long* samples, unsigned long long* bytes);
+	void	GetSummary(int at, HopSummary* sum);
+	DWORD	ProbeInterval(int at);
 	
 	void	SetAddr(int at, u_long addr);
 	void	SetAddr6(int at, IPV6_ADDRESS_EX addrex);
 	void	SetName(int at, char* n);
 	void	SetErrorName(int at,DWORD errnum);
-	void	UpdateRTT(int at, int rtt);
-	void	AddReturned(int at);
+	void	AddReply(int at, int rtt);
+	void	AddSample(int at, int rtt, const sockaddr* from, unsigned round);
+	unsigned WaitProbe(int at, unsigned* round, ULONGLONG* sent);
+	void	StartReplay();
+	bool	ReplayProbe(long long time, int at, int rtt, unsigned id, unsigned round);
+	void	EndReplay();
 	void	AddXmit(int at);
+	void	AddTimestampXmit(int at);
+	void	UpdateTimestamp(int at, u_long originate, u_long receive, u_long transmit, int rtt);
+	void	UpdateReplyTTL(sockaddr* from, int ttl);
 	
 	WinMTRDialog*		wmtrdlg;
-	union {
-		in_addr last_remote_addr;
-		in6_addr last_remote_addr6;
+	union {// address traced by this instance
+		sockaddr		target;
+		sockaddr_in		target4;
+		sockaddr_in6	target6;
 	};
+	char				label[NI_MAXHOST];
+	unsigned char		tos;		// TOS / traffic class byte of the probes (DSCP << 2)
+	unsigned			target_id;	// AddressTable id of the target, set by DoTrace
+	ProbeLog*			probeLog;	// every probe is recorded there if set, see WinMTRReplay.h
+	int					probeTrace;	// number of this trace in probeLog
+	long long			vclock;		// Unix time (ms) of the probe being replayed, 0 when live
 	bool				hasIPv6;
 	bool				tracing;
 	bool				initialized;
@@ -104,8 +237,32 @@ public:
 private:
 	HINSTANCE			hICMP_DLL;
 	
+	void	ReadCounters(int at, s_hopsnapshot* snap);
+	void	ResetEcho(s_hopstats& s);
+	void	ResetTimestamp(s_hopstats& s);
+	void	ResetIdle(int at, bool timestamp);
+	int		ReturnHops(int at, int ttl, bool* asymmetric);
+	bool	HasAddr(int at);
+	unsigned AddrId(int at);
+	unsigned LastResponder(int at);
+	void	ScoreSample(int at, unsigned responder, int rtt);
+	void	AddEvent(int at, int kind, int before, int after);
+	void	AddProbe(int at, int rtt, unsigned id, unsigned round);
+	ULONGLONG Ticks();
+	long long Now();
+	unsigned OpenRound(ULONGLONG now);
+	void	CloseRounds(ULONGLONG now);
+	int		SpikeOrigin(unsigned round, int dest);
+	
 	struct s_nethost	host[MaxHost];
-	HANDLE				ghMutex;
+	struct s_hopstats*	stats;			// MAX_HOPS entries, cache line aligned
+	std::vector<s_hopevent>	events;		// change points not fetched yet, under ghMutex
+	std::atomic<unsigned>	cur_round;	// last probe round opened, 0 before the first
+	std::atomic<ULONGLONG>	round_due;	// GetTickCount64() when the next one opens
+	std::atomic<unsigned long long>*	rounds;	// ROUND_SLOTS x MAX_HOPS cells: round << 32 | spike | rtt + 1 (0: lost)
+	std::vector<s_spike>	spikes;		// destination spikes not attributed yet, under ghMutex
+	HANDLE				ghMutex;		// hop names and addresses
+	std::atomic<int>	refs;			// owner + resolver threads still running, see Release
 };
 
 #endif	// ifndef WINMTRNET_H_
@@ -36,7 +36,11 @@ void WinMTROptions::DoDataExchange(CDataExchange* pDX)
 	DDX_Control(pDX, IDC_EDIT_SIZE, m_editSize);
 	DDX_Control(pDX, IDC_EDIT_INTERVAL, m_editInterval);
 	DDX_Control(pDX, IDC_EDIT_MAX_LRU, m_editMaxLRU);
+	DDX_Control(pDX, IDC_EDIT_FANOUT, m_editFanout);
+	DDX_Control(pDX, IDC_EDIT_DSCP, m_editDscp);
 	DDX_Control(pDX, IDC_CHECK_DNS, m_checkDNS);
+	DDX_Control(pDX, IDC_CHECK_TSTAMP, m_checkTimestamp);
+	DDX_Control(pDX, IDC_CHECK_DUAL, m_checkDualStack);
 }
 
 
@@ -60,7 +64,14 @@ BOOL WinMTROptions::OnInitDialog()
 	sprintf(strtmp, "%d", maxLRU);
 	m_editMaxLRU.SetWindowText(strtmp);
 
+	sprintf(strtmp, "%d", fanout);
+	m_editFanout.SetWindowText(strtmp);
+
+	m_editDscp.SetWindowText(dscp.c_str());
+
 	m_checkDNS.SetCheck(useDNS);
+	m_checkTimestamp.SetCheck(useTimestamp);
+	m_checkDualStack.SetCheck(useDualStack);
 	
 	m_editInterval.SetFocus();
 	return FALSE;
@@ -77,6 +88,8 @@ void WinMTROptions::OnOK()
 	char tmpstr[20];
 	
 	useDNS = m_checkDNS.GetCheck();
+	useTimestamp = m_checkTimestamp.GetCheck();
+	useDualStack = m_checkDualStack.GetCheck();
 
 	m_editInterval.GetWindowText(tmpstr, 20);
 	interval = atof(tmpstr);
@@ -87,6 +100,13 @@ void WinMTROptions::OnOK()
 	m_editMaxLRU.GetWindowText(tmpstr, 20);
 	maxLRU = atoi(tmpstr);
 
+	m_editFanout.GetWindowText(tmpstr, 20);
+	fanout = atoi(tmpstr);
+
+	char dscpstr[255];
+	m_editDscp.GetWindowText(dscpstr, 255);
+	dscp = dscpstr;
+
 	CDialog::OnOK();
 }
 
@@ -24,19 +24,27 @@
 class WinMTROptions : public CDialog
 {
 public:
-	WinMTROptions(double interval,int pingsize,int maxLRU,BOOL useDNS,CWnd* pParent=NULL) :
-		interval(interval),pingsize(pingsize),maxLRU(maxLRU),useDNS(useDNS),CDialog(WinMTROptions::IDD, pParent) {};
+	WinMTROptions(double interval,int pingsize,int maxLRU,BOOL useDNS,BOOL useTimestamp,BOOL useDualStack,int fanout,const char* dscp,CWnd* pParent=NULL) :
+		interval(interval),pingsize(pingsize),maxLRU(maxLRU),useDNS(useDNS),useTimestamp(useTimestamp),useDualStack(useDualStack),fanout(fanout),dscp(dscp),CDialog(WinMTROptions::IDD, pParent) {};
 		
 	double GetInterval()			{ return interval; };
 	int GetPingSize()				{ return pingsize; };
 	int GetMaxLRU()					{ return maxLRU; };
 	BOOL GetUseDNS()				{ return useDNS; };
+	BOOL GetUseTimestamp()			{ return useTimestamp; };
+	BOOL GetUseDualStack()			{ return useDualStack; };
+	int GetFanout()					{ return fanout; };
+	const char* GetDscp()			{ return dscp.c_str(); };
 	
 	enum { IDD = IDD_DIALOG_OPTIONS };
 	CEdit	m_editSize;
 	CEdit	m_editInterval;
 	CEdit	m_editMaxLRU;
+	CEdit	m_editFanout;
+	CEdit	m_editDscp;
 	CButton	m_checkDNS;
+	CButton	m_checkTimestamp;
+	CButton	m_checkDualStack;
 	
 protected:
 	virtual void DoDataExchange(CDataExchange* pDX);
@@ -53,6 +61,10 @@ private:
 	int		pingsize;
 	int		maxLRU;
 	BOOL	useDNS;
+	BOOL	useTimestamp;
+	BOOL	useDualStack;
+	int		fanout;
+	std::string	dscp;
 };
 
 #endif // ifndef WINMTROPTIONS_H_
@@ -6,6 +6,7 @@
 #include "pch.h"
 #include "WinMTRGlobal.h"
 #include "WinMTRProperties.h"
+#include "WinMTRNet.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -20,6 +21,7 @@ static char THIS_FILE[] = __FILE__;
 // 
 //*****************************************************************************
 BEGIN_MESSAGE_MAP(WinMTRProperties, CDialog)
+	ON_BN_CLICKED(IDC_BUTTON_PHISTORY, OnBnClickedExportHistory)
 END_MESSAGE_MAP()
 
 
@@ -30,6 +32,8 @@ END_MESSAGE_MAP()
 //*****************************************************************************
 WinMTRProperties::WinMTRProperties(CWnd* pParent) : CDialog(WinMTRProperties::IDD, pParent)
 {
+	net = NULL;
+	hop = 0;
 }
 
 
@@ -53,6 +57,10 @@ void WinMTRProperties::DoDataExchange(CDataExchange* pDX)
 	DDX_Control(pDX, IDC_EDIT_PBEST, m_editBest);
 	DDX_Control(pDX, IDC_EDIT_PWORST, m_editWorst);
 	DDX_Control(pDX, IDC_EDIT_PAVRG, m_editAvrg);
+
+	DDX_Control(pDX, IDC_EDIT_PLOSSPATTERN, m_editLossPattern);
+	DDX_Control(pDX, IDC_EDIT_PRECENT, m_editRecent);
+	DDX_Control(pDX, IDC_STATIC_PHISTORY, m_staticHistory);
 }
 
 
@@ -72,9 +80,9 @@ BOOL WinMTRProperties::OnInitDialog()
 
 	sprintf(buf, "%d", pck_loss);
 	m_editLoss.SetWindowText(buf);
-	sprintf(buf, "%d", pck_sent);
+	sprintf(buf, "%lld", pck_sent);
 	m_editSent.SetWindowText(buf);
-	sprintf(buf, "%d", pck_recv);
+	sprintf(buf, "%lld", pck_recv);
 	m_editRecv.SetWindowText(buf);
 
 	sprintf(buf, "%.1f", ping_last);
@@ -86,6 +94,53 @@ BOOL WinMTRProperties::OnInitDialog()
 	sprintf(buf, "%.1f", ping_avrg);
 	m_editAvrg.SetWindowText(buf);
 
+	m_editLossPattern.SetWindowText(losspattern.c_str());
+	m_editRecent.SetWindowText(recent.c_str());
+
+	if (net) {
+		unsigned long long samples, bytes;
+		net->GetHistorySize(hop, &samples, &bytes);
+		sprintf(buf, "%llu probes in %llu KB", samples, (bytes + 1023) / 1024);
+		m_staticHistory.SetWindowText(buf);
+	}
+	else
+		GetDlgItem(IDC_BUTTON_PHISTORY)->EnableWindow(FALSE);
+
 	return FALSE;
 }
 
+
+//*****************************************************************************
+// WinMTRProperties::OnBnClickedExportHistory
+//
+// Every probe of the hop as CSV, lost ones with an empty RTT
+//*****************************************************************************
+void WinMTRProperties::OnBnClickedExportHistory()
+{
+	TCHAR BASED_CODE szFilter[] = _T("CSV Files (*.csv)|*.csv|All Files (*.*)|*.*||");
+
+	CFileDialog dlg(FALSE,
+		_T("CSV"),
+		NULL,
+		OFN_HIDEREADONLY | OFN_EXPLORER,
+		szFilter,
+		this);
+	if (dlg.DoModal() != IDOK) return;
+
+	FILE* fp = fopen(dlg.GetPathName(), "wt");
+	if (fp == NULL) return;
+	std::vector<HistoryPoint> points;
+	int n = net->GetHistory(hop, points);
+	fprintf(fp, "Date (UTC)%sRTT\n", FIELD_SEPARATOR.c_str());
+	for (int i = 0; i < n; i++) {
+		char when[32];
+		time_t secs = (time_t)(points[i].time / 1000);
+		strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", gmtime(&secs));
+		if (points[i].rtt < 0)
+			fprintf(fp, "%s.%03dZ%s\n", when, (int)(points[i].time % 1000), FIELD_SEPARATOR.c_str());
+		else
+			fprintf(fp, "%s.%03dZ%s%d\n", when, (int)(points[i].time % 1000), FIELD_SEPARATOR.c_str(), points[i].rtt);
+	}
+	fclose(fp);
+}
+
@@ -13,6 +13,7 @@
 #ifndef WINMTRPROPERTIES_H_
 #define WINMTRPROPERTIES_H_
 
+class WinMTRNet;
 
 
 //*****************************************************************************
@@ -38,10 +39,16 @@ public:
 	float	ping_avrg;
 	float	ping_worst;
 
-	int		pck_sent;
-	int		pck_recv;
+	long long	pck_sent;
+	long long	pck_recv;
 	int		pck_loss;
 
+	std::string	losspattern;	// loss runs and Gilbert-Elliott model
+	std::string	recent;		// recent samples, one per line, newest first
+
+	WinMTRNet*	net;		// trace and hop of the full history
+	int		hop;
+
 	CEdit	m_editHost,
 			m_editIP,
 			m_editComment,
@@ -51,12 +58,16 @@ public:
 			m_editLast,
 			m_editBest,
 			m_editWorst,
-			m_editAvrg;
+			m_editAvrg,
+			m_editLossPattern,
+			m_editRecent;
+	CStatic	m_staticHistory;
 	
 protected:
 	virtual void DoDataExchange(CDataExchange* pDX);
 
 	virtual BOOL OnInitDialog();
+	afx_msg void OnBnClickedExportHistory();
 	
 	DECLARE_MESSAGE_MAP()
 };
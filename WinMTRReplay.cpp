@@ -0,0 +1,194 @@
+//*****************************************************************************
+// FILE:            WinMTRReplay.cpp
+//
+//*****************************************************************************
+#include "pch.h"
+#include "WinMTRGlobal.h"
+#include "WinMTRNet.h"
+#include "WinMTRReplay.h"
+
+ProbeLog::ProbeLog()
+{
+	InitializeSRWLock(&lock);
+	fp = NULL;
+}
+
+ProbeLog::~ProbeLog()
+{
+	Close();
+}
+
+bool ProbeLog::Open(const char* path)
+{
+	Close();
+	fp = fopen(path, "wt");
+	if(fp == NULL) return false;
+	buffer.resize(PROBELOG_BUFFER);
+	setvbuf(fp, &buffer[0], _IOFBF, buffer.size());
+	declared.clear();
+	fprintf(fp, "%s\n", PROBELOG_MAGIC);
+	return true;
+}
+
+void ProbeLog::Close()
+{
+	AcquireSRWLockExclusive(&lock);
+	if(fp) fclose(fp);
+	fp = NULL;
+	ReleaseSRWLockExclusive(&lock);
+}
+
+void ProbeLog::AddTrace(int nr, WinMTRNet* net)
+{
+	char addr[NI_MAXHOST];
+	if(getnameinfo(&net->target, sizeof(sockaddr_in6), addr, NI_MAXHOST, NULL, 0, NI_NUMERICHOST)) return;
+	AcquireSRWLockExclusive(&lock);
+	if(fp) fprintf(fp, "trace\t%d\t%s\t%s\n", nr, addr, net->label);
+	ReleaseSRWLockExclusive(&lock);
+}
+
+//*****************************************************************************
+// ProbeLog::Write
+//
+// One probe of trace nr, its responder declared first if new to the log
+//*****************************************************************************
+void ProbeLog::Write(int nr, long long time, int at, unsigned id, int rtt, unsigned round)
+{
+	AcquireSRWLockExclusive(&lock);
+	if(fp) {
+		if(id >= declared.size()) declared.resize(id + 1);
+		char addr[NI_MAXHOST];
+		if(id && !declared[id] && !getnameinfo(addresses.Get(id), sizeof(sockaddr_in6), addr, NI_MAXHOST, NULL, 0, NI_NUMERICHOST)) {
+			fprintf(fp, "addr\t%u\t%s\n", id, addr);
+			declared[id] = true;
+		}
+		fprintf(fp, "%d\t%lld\t%d\t%u\t%d\t%u\n", nr, time, at, declared[id] ? id : 0, rtt, round);
+	}
+	ReleaseSRWLockExclusive(&lock);
+}
+
+// numeric address of a log line, 0 if it doesn't parse
+static unsigned InternAddress(const char* text)
+{
+	addrinfo hints = { 0 }, *ai = NULL;
+	hints.ai_flags = AI_NUMERICHOST;
+	if(getaddrinfo(text, NULL, &hints, &ai) || !ai) return 0;
+	unsigned id = addresses.Intern(ai->ai_addr);
+	freeaddrinfo(ai);
+	return id;
+}
+
+// moves the events of the replayed traces out before their queues fill up
+static void DrainEvents(std::vector<WinMTRNet*>& nets, std::vector<std::vector<s_hopevent> >& events)
+{
+	std::vector<s_hopevent> batch;
+	for(size_t t = 0; t < nets.size(); ++t) {
+		if(!nets[t] || !nets[t]->GetEvents(batch)) continue;
+		events[t].insert(events[t].end(), batch.begin(), batch.end());
+	}
+}
+
+//*****************************************************************************
+// ReplayProbeLog
+//
+// Replays a probe log into new traces, one per trace of the log (nets, by
+// number, NULL for unused numbers; the caller deletes them), using the
+// interval and alert rules of dlg. events gets the change points, spikes
+// and alerts of each trace, stamped with the virtual time. Probe lines are
+// parsed by hand and fed straight to WinMTRNet::ReplayProbe: no probe
+// thread, no sleep, no name resolution. Every REPLAY_DRAIN probes, percent
+// gets the share of the log read and cancel is checked. False if the file
+// is not a probe log.
+//*****************************************************************************
+bool ReplayProbeLog(const char* path, WinMTRDialog* dlg, std::vector<WinMTRNet*>& nets, std::vector<std::vector<s_hopevent> >& events, s_replaystats* st,
+	std::atomic<int>* percent, const std::atomic<bool>* cancel)
+{
+	nets.clear();
+	events.clear();
+	memset(st, 0, sizeof(*st));
+	FILE* fp = fopen(path, "rt");
+	if(fp == NULL) return false;
+	std::vector<char> buffer(PROBELOG_BUFFER);
+	setvbuf(fp, &buffer[0], _IOFBF, buffer.size());
+	long long size = 0;
+	if(!_fseeki64(fp, 0, SEEK_END)) size = _ftelli64(fp);
+	_fseeki64(fp, 0, SEEK_SET);
+	char line[4096];
+	if(!fgets(line, sizeof(line), fp) || strncmp(line, PROBELOG_MAGIC, strlen(PROBELOG_MAGIC))) {
+		fclose(fp);
+		return false;
+	}
+
+	LARGE_INTEGER freq, start, end;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&start);
+	std::vector<unsigned> ids(1, 0);// log id -> AddressTable id
+	while(fgets(line, sizeof(line), fp)) {
+		if(*line >= '0' && *line <= '9') {
+			char* p = line;
+			unsigned nr = strtoul(p, &p, 10);
+			long long time = _strtoi64(p, &p, 10);
+			int at = strtol(p, &p, 10);
+			unsigned id = strtoul(p, &p, 10);
+			int rtt = strtol(p, &p, 10);
+			unsigned round = strtoul(p, &p, 10);
+			if((*p && *p != '\n' && *p != '\r') || nr >= nets.size() || !nets[nr] || id >= ids.size()
+				|| !nets[nr]->ReplayProbe(time, at, rtt < -1 ? -1 : rtt, ids[id], round)) {
+				++st->skipped;
+				continue;
+			}
+			if(!(++st->probes % REPLAY_DRAIN)) {
+				DrainEvents(nets, events);
+				if(percent && size > 0) percent->store((int)(_ftelli64(fp) * 100 / size), std::memory_order_relaxed);
+				if(cancel && cancel->load(std::memory_order_relaxed)) {
+					st->cancelled = true;
+					break;
+				}
+			}
+			continue;
+		}
+		unsigned nr;
+		char addr[NI_MAXHOST], label[NI_MAXHOST];
+		if(sscanf(line, "addr\t%u\t%1024[^\t\r\n]", &nr, addr) == 2) {
+			if(nr >= ids.size()) ids.resize(nr + 1, 0);
+			ids[nr] = InternAddress(addr);
+		}
+		else if(sscanf(line, "trace\t%u\t%1024[^\t]\t%1024[^\r\n]", &nr, addr, label) == 3 && nr < REPLAY_MAX_TRACES) {
+			if(nr >= nets.size()) {
+				nets.resize(nr + 1, NULL);
+				events.resize(nr + 1);
+			}
+			unsigned target = InternAddress(addr);
+			if(nets[nr] || !target) continue;
+			nets[nr] = new WinMTRNet(dlg);
+			nets[nr]->SetTarget((sockaddr*)addresses.Get(target));
+			strncpy(nets[nr]->label, label, NI_MAXHOST - 1);
+			nets[nr]->label[NI_MAXHOST - 1] = '\0';
+			nets[nr]->StartReplay();
+		}
+		else if(*line != '#' && *line != '\n')
+			++st->skipped;
+	}
+	fclose(fp);
+	for(size_t t = 0; t < nets.size(); ++t)
+		if(nets[t]) nets[t]->EndReplay();
+	DrainEvents(nets, events);
+	QueryPerformanceCounter(&end);
+	st->seconds = (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
+	if(percent) percent->store(100, std::memory_order_relaxed);
+	return true;
+}
+
+//*****************************************************************************
+// ReplayProbeThread
+//
+// Runs the replay of an s_replayjob, which the dialog polls for progress
+// and picks up once done is set
+//*****************************************************************************
+unsigned WINAPI ReplayProbeThread(void* p)
+{
+	s_replayjob* job = (s_replayjob*)p;
+	job->ok = ReplayProbeLog(job->path.c_str(), job->dlg, job->nets, job->events, &job->st, &job->percent, &job->cancel);
+	job->done.store(true, std::memory_order_release);
+	return 0;
+}
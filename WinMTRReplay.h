@@ -0,0 +1,85 @@
+//*****************************************************************************
+// FILE:            WinMTRReplay.h
+//
+//
+// DESCRIPTION:
+//   Probe logs: every probe of a session as recorded, and their replay in
+//   virtual time through the statistics, the path length guess, the change
+//   and spike detectors and the alert rules of the current build and
+//   settings, as fast as the log can be read.
+//
+// NOTES:
+//   File format, after the PROBELOG_MAGIC line:
+//     trace <tab> nr <tab> target address <tab> label
+//     addr <tab> id <tab> address
+//     nr <tab> Unix time (ms) <tab> hop (0 based) <tab> addr id <tab> rtt <tab> round
+//   An address is declared before the first probe it answered, id 0 is
+//   the unknown one, rtt -1 a lost probe, round 0 a probe between rounds.
+//   Topology and baselines are left out of replays: they belong to the
+//   live traces of the process.
+//
+//*****************************************************************************
+
+#ifndef WINMTRREPLAY_H_
+#define WINMTRREPLAY_H_
+
+#define PROBELOG_MAGIC		"# WinMTR probe log 1"
+#define PROBELOG_FILTER		_T("WinMTR probe logs (*.wmtrlog)|*.wmtrlog|All Files (*.*)|*.*||")
+#define PROBELOG_BUFFER		(1 << 20)	// stdio buffer of the log, both ways
+#define REPLAY_MAX_TRACES	256
+#define REPLAY_DRAIN		4096		// probes between two collections of the replay events
+
+class WinMTRDialog;
+
+//*****************************************************************************
+// CLASS:  ProbeLog
+//
+// Writer of a probe log, shared by the probe threads of every trace of a
+// session under one lock
+//*****************************************************************************
+
+class ProbeLog
+{
+public:
+	ProbeLog();
+	~ProbeLog();
+
+	bool	Open(const char* path);
+	void	Close();
+	void	AddTrace(int nr, WinMTRNet* net);
+	void	Write(int nr, long long time, int at, unsigned id, int rtt, unsigned round);
+
+private:
+	SRWLOCK				lock;
+	FILE*				fp;
+	std::vector<char>	buffer;
+	std::vector<bool>	declared;	// by AddressTable id
+};
+
+// Outcome of ReplayProbeLog
+struct s_replaystats {
+	unsigned long long probes;		// replayed
+	unsigned long long skipped;		// malformed lines, unknown traces / addresses, hops out of range
+	double seconds;					// wall clock time of the replay
+	bool cancelled;					// stopped before the end of the log
+};
+
+// A replay on its own thread, see ReplayProbeThread. The thread owns the
+// rest until it sets done.
+struct s_replayjob {
+	std::string path;
+	WinMTRDialog* dlg;
+	std::atomic<int> percent;		// of the log read so far
+	std::atomic<bool> cancel;		// set by the dialog to stop early
+	std::atomic<bool> done;
+	bool ok;
+	std::vector<WinMTRNet*> nets;
+	std::vector<std::vector<s_hopevent> > events;
+	s_replaystats st;
+};
+
+bool ReplayProbeLog(const char* path, WinMTRDialog* dlg, std::vector<WinMTRNet*>& nets, std::vector<std::vector<s_hopevent> >& events, s_replaystats* st,
+	std::atomic<int>* percent = NULL, const std::atomic<bool>* cancel = NULL);
+unsigned WINAPI ReplayProbeThread(void* job);
+
+#endif	// ifndef WINMTRREPLAY_H_
@@ -0,0 +1,896 @@
+//*****************************************************************************
+// FILE:            WinMTRStats.cpp
+//
+//*****************************************************************************
+#include "pch.h"
+#include "WinMTRStats.h"
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+//*****************************************************************************
+// EchoCounters::Reset
+//
+// Writer thread only, inside its seqlock write section
+//*****************************************************************************
+void EchoCounters::Reset()
+{
+	xmit.store(0, std::memory_order_relaxed);
+	returned.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+	last_ms.store(0, std::memory_order_relaxed);
+	best_ms.store(0, std::memory_order_relaxed);
+	worst_ms.store(0, std::memory_order_relaxed);
+}
+
+void EchoCounters::AddSent()
+{
+	WriterAdd(xmit, 1ULL);
+}
+
+//*****************************************************************************
+// EchoCounters::AddReply
+//
+// Writer thread only. returned goes last: best is taken from the first
+// reply while it is still 0.
+//*****************************************************************************
+void EchoCounters::AddReply(int ms)
+{
+	last_ms.store(ms, std::memory_order_relaxed);
+	WriterAdd(sum, (unsigned long long)ms << RTT_FIXED_SHIFT);
+	if(best_ms.load(std::memory_order_relaxed) > ms || returned.load(std::memory_order_relaxed) == 0)
+		best_ms.store(ms, std::memory_order_relaxed);
+	if(worst_ms.load(std::memory_order_relaxed) < ms)
+		worst_ms.store(ms, std::memory_order_relaxed);
+	WriterAdd(returned, 1ULL);
+}
+
+void EchoCounters::Read(unsigned long long* sent, unsigned long long* recv, unsigned long long* total, int* last, int* best, int* worst) const
+{
+	*sent = xmit.load(std::memory_order_relaxed);
+	*recv = returned.load(std::memory_order_relaxed);
+	*total = sum.load(std::memory_order_relaxed);
+	*last = last_ms.load(std::memory_order_relaxed);
+	*best = best_ms.load(std::memory_order_relaxed);
+	*worst = worst_ms.load(std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// LatencyHistogram::Reset
+//
+// Writer thread only, inside its seqlock write section: readers on other
+// threads go through the seqlock
+//*****************************************************************************
+void LatencyHistogram::Reset()
+{
+	for(int b = 0; b < HIST_BUCKETS; ++b)
+		counts[b].store(0, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// LatencyHistogram::Add
+//
+// Writer thread only: a plain load/store instead of a locked increment
+//*****************************************************************************
+void LatencyHistogram::Add(int ms)
+{
+	std::atomic<unsigned long long>& c = counts[Bucket(ms)];
+	c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// LatencyHistogram::Percentile
+//
+//*****************************************************************************
+int LatencyHistogram::Percentile(int pct) const
+{
+	int ret;
+	Percentiles(&pct, 1, &ret);
+	return ret;
+}
+
+//*****************************************************************************
+// LatencyHistogram::Percentiles
+//
+// Values at or below which pct[i] percent of the samples fall, for
+// ascending pct[]; 0 while there are no samples
+//*****************************************************************************
+void LatencyHistogram::Percentiles(const int* pct, int n, int* out) const
+{
+	unsigned long long copy[HIST_BUCKETS];
+	Read(copy);
+	Percentiles(copy, pct, n, out);
+}
+
+//*****************************************************************************
+// LatencyHistogram::Read
+//
+// Copy of the bucket counts
+//*****************************************************************************
+void LatencyHistogram::Read(unsigned long long* out) const
+{
+	for(int b = 0; b < HIST_BUCKETS; ++b)
+		out[b] = counts[b].load(std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// LatencyHistogram::Percentiles
+//
+// The same from bucket counts, e.g. merged ones
+//*****************************************************************************
+void LatencyHistogram::Percentiles(const unsigned long long* copy, const int* pct, int n, int* out)
+{
+	unsigned long long total = 0;
+	for(int b = 0; b < HIST_BUCKETS; ++b)
+		total += copy[b];
+	unsigned long long seen = 0;
+	int b = 0;
+	for(int i = 0; i < n; ++i) {
+		if(!total) {
+			out[i] = 0;
+			continue;
+		}
+		unsigned long long rank = (total * pct[i] + 99) / 100;// nearest rank
+		if(!rank) rank = 1;
+		while(b < HIST_BUCKETS - 1 && seen + copy[b] < rank)
+			seen += copy[b++];
+		out[i] = Value(b);
+	}
+}
+
+//*****************************************************************************
+// LatencyHistogram::Bucket
+//
+// Below HIST_SUB_BUCKETS one bucket per ms; above, each octave [2^k, 2^k+1)
+// is split in HIST_SUB_BUCKETS/2 equal buckets
+//*****************************************************************************
+int LatencyHistogram::Bucket(int ms)
+{
+	if(ms < 0) ms = 0;
+	if(ms < HIST_SUB_BUCKETS) return ms;
+	int shift = 0;
+	while((ms >> shift) >= HIST_SUB_BUCKETS) ++shift;
+	int b = HIST_SUB_BUCKETS + (shift - 1) * HIST_SUB_BUCKETS / 2 + (ms >> shift) - HIST_SUB_BUCKETS / 2;
+	return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+//*****************************************************************************
+// LatencyHistogram::Value
+//
+// Middle of the range of values a bucket holds
+//*****************************************************************************
+int LatencyHistogram::Value(int bucket)
+{
+	if(bucket < HIST_SUB_BUCKETS) return bucket;
+	int shift = (bucket - HIST_SUB_BUCKETS) / (HIST_SUB_BUCKETS / 2) + 1;
+	int sub = (bucket - HIST_SUB_BUCKETS) % (HIST_SUB_BUCKETS / 2) + HIST_SUB_BUCKETS / 2;
+	return (sub << shift) + (1 << shift) / 2;
+}
+
+//*****************************************************************************
+// RunningStats::Reset
+//
+// Writer thread only, inside its seqlock write section: readers on other
+// threads go through the seqlock
+//*****************************************************************************
+void RunningStats::Reset()
+{
+	count.store(0, std::memory_order_relaxed);
+	prev.store(0, std::memory_order_relaxed);
+	mean.store(0, std::memory_order_relaxed);
+	m2.store(0, std::memory_order_relaxed);
+	jitter.store(0, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// RunningStats::Add
+//
+// Writer thread only
+//*****************************************************************************
+void RunningStats::Add(int ms)
+{
+	unsigned long long n = count.load(std::memory_order_relaxed) + 1;
+	double m = mean.load(std::memory_order_relaxed);
+	double delta = ms - m;
+	m += delta / n;
+	m2.store(m2.load(std::memory_order_relaxed) + delta * (ms - m), std::memory_order_relaxed);
+	mean.store(m, std::memory_order_relaxed);
+	if(n > 1) {// J += (|D| - J) / 16
+		double j = jitter.load(std::memory_order_relaxed);
+		jitter.store(j + (abs(ms - prev.load(std::memory_order_relaxed)) - j) / 16, std::memory_order_relaxed);
+	}
+	prev.store(ms, std::memory_order_relaxed);
+	count.store(n, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// RunningStats::Read
+//
+// Sample standard deviation, 0 below two samples
+//*****************************************************************************
+void RunningStats::Read(double* mean_out, double* stddev_out, double* jitter_out) const
+{
+	unsigned long long n = count.load(std::memory_order_relaxed);
+	*mean_out = mean.load(std::memory_order_relaxed);
+	*stddev_out = n > 1 ? sqrt(m2.load(std::memory_order_relaxed) / (n - 1)) : 0;
+	*jitter_out = jitter.load(std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// RunningStats::ReadMoments
+//
+// Raw Welford state, for HopSummary
+//*****************************************************************************
+void RunningStats::ReadMoments(unsigned long long* n_out, double* mean_out, double* m2_out) const
+{
+	*n_out = count.load(std::memory_order_relaxed);
+	*mean_out = mean.load(std::memory_order_relaxed);
+	*m2_out = m2.load(std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// SlidingWindow::Reset
+//
+// Writer thread only, inside its seqlock write section: readers on other
+// threads go through the seqlock
+//*****************************************************************************
+void SlidingWindow::Reset(int seconds)
+{
+	slots = seconds < WINDOW_SLOTS ? seconds : WINDOW_SLOTS;
+	slice_ms = seconds * 1000 / slots;
+	current = 0;
+	memset(slot_sent, 0, sizeof(slot_sent));
+	memset(slot_recv, 0, sizeof(slot_recv));
+	memset(slot_sum, 0, sizeof(slot_sum));
+	sent.store(0, std::memory_order_relaxed);
+	recv.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// SlidingWindow::Advance
+//
+// Drops the slices that fell out of the window, at most one full turn
+//*****************************************************************************
+void SlidingWindow::Advance(unsigned long long now)
+{
+	unsigned long long slice = now / slice_ms;
+	if(slice <= current) return;
+	unsigned long long expired = slice - current < (unsigned long long)slots ? slice - current : slots;
+	for(; expired; --expired) {
+		int at = (int)((slice - expired + 1) % slots);
+		sent.store(sent.load(std::memory_order_relaxed) - slot_sent[at], std::memory_order_relaxed);
+		recv.store(recv.load(std::memory_order_relaxed) - slot_recv[at], std::memory_order_relaxed);
+		sum.store(sum.load(std::memory_order_relaxed) - slot_sum[at], std::memory_order_relaxed);
+		slot_sent[at] = slot_recv[at] = 0;
+		slot_sum[at] = 0;
+	}
+	current = slice;
+}
+
+//*****************************************************************************
+// SlidingWindow::AddSent
+//
+// Writer thread only
+//*****************************************************************************
+void SlidingWindow::AddSent(unsigned long long now)
+{
+	Advance(now);
+	++slot_sent[current % slots];
+	sent.store(sent.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// SlidingWindow::AddReply
+//
+// Writer thread only
+//*****************************************************************************
+void SlidingWindow::AddReply(unsigned long long now, int ms)
+{
+	Advance(now);
+	int at = (int)(current % slots);
+	++slot_recv[at];
+	slot_sum[at] += ms;
+	recv.store(recv.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	sum.store(sum.load(std::memory_order_relaxed) + ms, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// SlidingWindow::Read
+//
+//*****************************************************************************
+void SlidingWindow::Read(long long* sent_out, long long* recv_out, int* avg_out) const
+{
+	*sent_out = sent.load(std::memory_order_relaxed);
+	*recv_out = recv.load(std::memory_order_relaxed);
+	long long total = sum.load(std::memory_order_relaxed);
+	*avg_out = *recv_out ? (int)(total / *recv_out) : 0;
+}
+
+//*****************************************************************************
+// LossPattern::Reset
+//
+// Writer thread only, inside its seqlock write section: readers on other
+// threads go through the seqlock
+//*****************************************************************************
+void LossPattern::Reset()
+{
+	history = 0;
+	run = 0;
+	probes.store(0, std::memory_order_relaxed);
+	lost.store(0, std::memory_order_relaxed);
+	lost2.store(0, std::memory_order_relaxed);
+	lost_x.store(0, std::memory_order_relaxed);
+	lost3.store(0, std::memory_order_relaxed);
+	starts.store(0, std::memory_order_relaxed);
+	longest.store(0, std::memory_order_relaxed);
+	for(int b = 0; b < BURST_BUCKETS; ++b)
+		bursts[b].store(0, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// LossPattern::Bucket
+//
+//*****************************************************************************
+int LossPattern::Bucket(int run)
+{
+	return run < BURST_BUCKETS ? run - 1 : BURST_BUCKETS - 1;
+}
+
+//*****************************************************************************
+// LossPattern::Add
+//
+// Writer thread only, once per probe
+//*****************************************************************************
+void LossPattern::Add(bool lost_now)
+{
+	unsigned long long n = probes.load(std::memory_order_relaxed);
+	if(lost_now) {
+		lost.store(lost.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if(n >= 1 && (history & 1))
+			lost2.store(lost2.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if(n >= 2 && (history & 2)) {
+			lost_x.store(lost_x.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			if(history & 1)
+				lost3.store(lost3.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+		if(!run++)
+			starts.store(starts.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if(run > longest.load(std::memory_order_relaxed))
+			longest.store(run, std::memory_order_relaxed);
+	} else if(run) {
+		std::atomic<unsigned long long>& c = bursts[Bucket(run)];
+		c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		run = 0;
+	}
+	history = (history << 1) | (lost_now ? 1 : 0);
+	probes.store(n + 1, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// LossPattern::Read
+//
+// Gilbert's estimator: with a = P(1), b = P(1|1) and c = P(1|1x1), the bad
+// state keeps (q = 1 - r) with q = (b^2 - ac) / (b(a + c) - 2ac) and loses
+// probes with probability d = b / q = 1 - h. Random loss makes it degenerate
+// (b = c = a), as do short traces; then the simple Gilbert model (h = 0) is
+// fitted to the loss runs instead.
+//*****************************************************************************
+void LossPattern::Read(LossSummary* out) const
+{
+	double n = (double)probes.load(std::memory_order_relaxed);
+	double n1 = (double)lost.load(std::memory_order_relaxed);
+	double n11 = (double)lost2.load(std::memory_order_relaxed);
+	double n1x1 = (double)lost_x.load(std::memory_order_relaxed);
+	double n111 = (double)lost3.load(std::memory_order_relaxed);
+	out->nr_bursts = starts.load(std::memory_order_relaxed);
+	out->longest = longest.load(std::memory_order_relaxed);
+	for(int b = 0; b < BURST_BUCKETS; ++b)
+		out->bursts[b] = bursts[b].load(std::memory_order_relaxed);
+	out->mean_burst = out->nr_bursts ? n1 / out->nr_bursts : 0;
+
+	out->ge_p = 0;
+	out->ge_r = 1;
+	out->ge_h = 1;
+	if(n1 == 0) return;
+	if(n1 < n && n1x1 > 0) {
+		double a = n1 / n, b = n11 / n1, c = n111 / n1x1;
+		double den = b * (a + c) - 2 * a * c;
+		double q = den != 0 ? (b * b - a * c) / den : 0;
+		double d = q > 0 ? b / q : 0;
+		if(q > 0 && q < 1 && d > a && d <= 1) {
+			out->ge_r = 1 - q;
+			out->ge_h = 1 - d;
+			out->ge_p = a * out->ge_r / (d - a);
+			if(out->ge_p > 1) out->ge_p = 1;
+			return;
+		}
+	}
+	out->ge_h = 0;
+	out->ge_r = out->nr_bursts / n1;
+	out->ge_p = n1 < n ? out->nr_bursts / (n - n1) : 1;
+	if(out->ge_p > 1) out->ge_p = 1;
+}
+
+//*****************************************************************************
+// ChangeDetector::Reset
+//
+//*****************************************************************************
+void ChangeDetector::Reset()
+{
+	probes = 0;
+	replies = 0;
+	settle = 0;
+	pending = CHANGE_NONE;
+	pending_from = 0;
+	base = dev = 0;
+	up = down = 0;
+	loss = 0;
+	lossy = false;
+}
+
+//*****************************************************************************
+// ChangeDetector::Add
+//
+// ms is -1 for a lost probe. Returns a CHANGE_EVENTS value; before / after
+// are the latency levels in ms, or the loss rate in % (after only). A latency
+// change is reported once the new level has been measured, CHANGE_SETTLE
+// replies after the CUSUM alarm, and only if it moved by CHANGE_MIN_STEP.
+//*****************************************************************************
+int ChangeDetector::Add(int ms, int* before, int* after)
+{
+	loss += ((ms < 0 ? 1 : 0) - loss) / 16;
+	if(++probes == CHANGE_WARMUP)
+		lossy = loss > CHANGE_ONSET_RATE;// the state at start is not a change
+	if(probes > CHANGE_WARMUP && lossy != (lossy ? loss > CHANGE_CLEAR_RATE : loss > CHANGE_ONSET_RATE)) {
+		lossy = !lossy;
+		*before = 0;
+		*after = (int)(loss * 100 + 0.5);
+		return lossy ? CHANGE_LOSS_ONSET : CHANGE_LOSS_CLEARED;
+	}
+	if(ms < 0) return CHANGE_NONE;
+
+	if(!replies++)
+		settle = CHANGE_WARMUP;
+	if(settle) {// learn the level at start and after a change
+		level[--settle] = ms;
+		if(settle) return CHANGE_NONE;
+		int n = pending ? CHANGE_SETTLE : CHANGE_WARMUP;// median and median absolute deviation: spikes do not move them
+		std::nth_element(level, level + n / 2, level + n);
+		base = level[n / 2];
+		for(int i = 0; i < n; ++i) level[i] = abs(level[i] - (int)base);
+		std::nth_element(level, level + n / 2, level + n);
+		dev = level[n / 2] * 1.2;// close to the mean absolute deviation for normal noise
+		up = down = 0;
+		if(!pending || fabs(base - pending_from) < CHANGE_MIN_STEP) {
+			pending = CHANGE_NONE;
+			return CHANGE_NONE;
+		}
+		int kind = pending;
+		pending = CHANGE_NONE;
+		*before = (int)(pending_from + 0.5);
+		*after = (int)(base + 0.5);
+		return kind;
+	}
+
+	double scale = dev > 1 ? dev : 1;
+	double z = (ms - base) / scale;
+	if(z > CHANGE_CLIP) z = CHANGE_CLIP;// a lone spike is not a step
+	else if(z < -CHANGE_CLIP) z = -CHANGE_CLIP;
+	dev += (fabs(z) * scale - dev) / 16;
+	base += z * scale / 32;
+	up = up + z - CHANGE_CUSUM_K > 0 ? up + z - CHANGE_CUSUM_K : 0;
+	down = down - z - CHANGE_CUSUM_K > 0 ? down - z - CHANGE_CUSUM_K : 0;
+	if(up >= CHANGE_CUSUM_H || down >= CHANGE_CUSUM_H) {// measure the new level, then report
+		pending = up >= CHANGE_CUSUM_H ? CHANGE_LATENCY_UP : CHANGE_LATENCY_DOWN;
+		pending_from = base;
+		settle = CHANGE_SETTLE;
+	}
+	return CHANGE_NONE;
+}
+
+void SpikeDetector::Reset()
+{
+	replies = 0;
+	level = dev = 0;
+}
+
+// ms is -1 for a lost probe, never a spike
+bool SpikeDetector::Add(int ms)
+{
+	if(ms < 0) return false;
+	if(replies < SPIKE_WARMUP) {
+		++replies;
+		level += (ms - level) / replies;
+		dev += (fabs(ms - level) - dev) / replies;
+		return false;
+	}
+	double d = ms - level, scale = dev > 1 ? dev : 1;
+	bool spike = d >= SPIKE_MIN_STEP && d >= SPIKE_K * scale;
+	if(d > SPIKE_K * scale) d = SPIKE_K * scale;
+	else if(d < -SPIKE_K * scale) d = -SPIKE_K * scale;
+	level += d / 16;
+	dev += (fabs(d) - dev) / 16;
+	return spike;
+}
+
+void ProbeRate::Reset()
+{
+	shift.store(0, std::memory_order_relaxed);
+	since = calm = 0;
+}
+
+//*****************************************************************************
+// ProbeRate::Update
+//
+// Once per probe. trouble starts (or restarts) a hurry at the fastest rate,
+// lasting trouble holds it for up to RATE_MAX_SECONDS. Intervals are in ms,
+// a fastest one of 0 or not below base turns the hurry off.
+//*****************************************************************************
+void ProbeRate::Update(bool trouble, bool lasting, unsigned base, unsigned fastest, unsigned long long now)
+{
+	int s = shift.load(std::memory_order_relaxed);
+	if(!fastest || fastest >= base) {
+		if(s) shift.store(0, std::memory_order_relaxed);
+		return;
+	}
+	if(trouble) {
+		if(!s) since = now;
+		int full = 0;
+		while(full < 16 && (base >> full) > fastest) ++full;
+		shift.store(full, std::memory_order_relaxed);
+		calm = now;
+		return;
+	}
+	if(!s) return;
+	if(lasting && now - since < RATE_MAX_SECONDS * 1000ULL) {
+		calm = now;
+		return;
+	}
+	if(now - calm >= RATE_CALM_SECONDS * 1000ULL) {
+		shift.store(s - 1, std::memory_order_relaxed);
+		calm = now;
+	}
+}
+
+unsigned ProbeRate::Interval(unsigned base, unsigned fastest) const
+{
+	unsigned ms = base >> shift.load(std::memory_order_relaxed);
+	if(ms >= base || !fastest || fastest >= base) return base;
+	return ms > fastest ? ms : fastest;
+}
+
+//*****************************************************************************
+// SampleHistory::Init
+//
+//*****************************************************************************
+void SampleHistory::Init()
+{
+	head.store(NULL, std::memory_order_relaxed);
+	samples.store(0, std::memory_order_relaxed);
+	blocks.store(0, std::memory_order_relaxed);
+	tail = NULL;
+	pos = 0;
+	prev_time = prev_delta = 0;
+	prev_value = 0;
+	lead = -1;
+	trail = 0;
+}
+
+//*****************************************************************************
+// SampleHistory::Clear
+//
+// Only while neither the writer nor a reader is running
+//*****************************************************************************
+void SampleHistory::Clear()
+{
+	HistoryBlock* b = head.load(std::memory_order_relaxed);
+	while(b) {
+		HistoryBlock* next = b->next.load(std::memory_order_relaxed);
+		delete b;
+		b = next;
+	}
+	Init();
+}
+
+//*****************************************************************************
+// SampleHistory::Put
+//
+// Appends the n low bits of v to the tail block, most significant first
+//*****************************************************************************
+void SampleHistory::Put(unsigned long long v, int n)
+{
+	while(n > 0) {
+		int room = 64 - (int)(pos & 63);
+		int take = n < room ? n : room;
+		unsigned long long chunk = (v >> (n - take)) & (take == 64 ? ~0ULL : (1ULL << take) - 1);
+		std::atomic<unsigned long long>& w = tail->words[pos >> 6];
+		w.store(w.load(std::memory_order_relaxed) | (chunk << (room - take)), std::memory_order_relaxed);
+		pos += take;
+		n -= take;
+	}
+}
+
+//*****************************************************************************
+// SampleHistory::Get
+//
+//*****************************************************************************
+unsigned long long SampleHistory::Get(const HistoryBlock* b, unsigned* at, int n)
+{
+	unsigned long long v = 0;
+	while(n > 0) {
+		int room = 64 - (int)(*at & 63);
+		int take = n < room ? n : room;
+		unsigned long long w = b->words[*at >> 6].load(std::memory_order_relaxed);
+		v = (v << take) | ((w >> (room - take)) & (take == 64 ? ~0ULL : (1ULL << take) - 1));
+		*at += take;
+		n -= take;
+	}
+	return v;
+}
+
+//*****************************************************************************
+// SampleHistory::NewBlock
+//
+//*****************************************************************************
+void SampleHistory::NewBlock()
+{
+	HistoryBlock* b = new HistoryBlock;
+	b->next.store(NULL, std::memory_order_relaxed);
+	b->bits.store(0, std::memory_order_relaxed);
+	for(int i = 0; i < HISTORY_BLOCK_WORDS; ++i)
+		b->words[i].store(0, std::memory_order_relaxed);
+	if(tail) tail->next.store(b, std::memory_order_release);
+	else head.store(b, std::memory_order_release);
+	tail = b;
+	pos = 0;
+	blocks.store(blocks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// SampleHistory::Add
+//
+// Writer thread only. Each block starts with a raw timestamp and value, so
+// it decodes on its own. Then per probe:
+//   delta of delta  0: '0', 7 bits: '10', 9 bits: '110', 12 bits: '1110',
+//                   32 bits: '1111' (two's complement)
+//   value XOR       0: '0', inside the last window: '10' + window bits,
+//                   else '11' + 5 bits leading zeros + 5 bits length - 1 + bits
+// Values are rtt + 1, so a lost probe is 0.
+//*****************************************************************************
+void SampleHistory::Add(long long time, int rtt)
+{
+	unsigned value = (unsigned)(rtt + 1);
+	long long delta = time - prev_time;
+	long long dod = delta - prev_delta;
+	if(!tail || pos + 4 + 32 + 2 + 10 + 32 > HISTORY_BLOCK_WORDS * 64 || dod < INT_MIN || dod > INT_MAX) {
+		NewBlock();
+		Put((unsigned long long)time, 64);
+		Put(value, 32);
+		delta = 0;
+		lead = -1;
+	} else {
+		if(dod == 0) Put(0, 1);
+		else if(dod >= -64 && dod < 64) { Put(2, 2); Put((unsigned long long)dod, 7); }
+		else if(dod >= -256 && dod < 256) { Put(6, 3); Put((unsigned long long)dod, 9); }
+		else if(dod >= -2048 && dod < 2048) { Put(14, 4); Put((unsigned long long)dod, 12); }
+		else { Put(15, 4); Put((unsigned long long)dod, 32); }
+
+		unsigned x = value ^ prev_value;
+		if(!x) Put(0, 1);
+		else {
+			int lz = 0, tz = 0;
+			while(!(x & (0x80000000u >> lz))) ++lz;
+			while(!(x & (1u << tz))) ++tz;
+			if(lead >= 0 && lz >= lead && tz >= trail) {
+				Put(2, 2);
+				Put(x >> trail, 32 - lead - trail);
+			} else {
+				lead = lz;
+				trail = tz;
+				Put(3, 2);
+				Put(lz, 5);
+				Put(31 - lz - tz, 5);
+				Put(x >> tz, 32 - lz - tz);
+			}
+		}
+	}
+	prev_time = time;
+	prev_delta = delta;
+	prev_value = value;
+	tail->bits.store(pos, std::memory_order_release);
+	samples.store(samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// SampleHistory::Decode
+//
+// All samples published so far, oldest first
+//*****************************************************************************
+int SampleHistory::Decode(std::vector<HistoryPoint>& out) const
+{
+	out.clear();
+	for(const HistoryBlock* b = head.load(std::memory_order_acquire); b; b = b->next.load(std::memory_order_acquire)) {
+		unsigned end = b->bits.load(std::memory_order_acquire);
+		if(!end) break;
+		unsigned at = 0;
+		long long time = (long long)Get(b, &at, 64), delta = 0;
+		unsigned value = (unsigned)Get(b, &at, 32);
+		int win_lead = 0, win_len = 0;
+		for(;;) {
+			HistoryPoint p = { time, (int)value - 1 };
+			out.push_back(p);
+			if(at >= end) break;
+
+			int n = 0;
+			while(n < 4 && Get(b, &at, 1)) ++n;
+			static const int dod_bits[5] = { 0, 7, 9, 12, 32 };
+			long long dod = 0;
+			if(n) {
+				dod = (long long)Get(b, &at, dod_bits[n]);
+				if(dod >> (dod_bits[n] - 1)) dod -= 1LL << dod_bits[n];// sign extend
+			}
+			delta += dod;
+			time += delta;
+
+			if(Get(b, &at, 1)) {
+				if(Get(b, &at, 1)) {
+					win_lead = (int)Get(b, &at, 5);
+					win_len = (int)Get(b, &at, 5) + 1;
+				}
+				value ^= (unsigned)Get(b, &at, win_len) << (32 - win_lead - win_len);
+			}
+		}
+	}
+	return (int)out.size();
+}
+
+//*****************************************************************************
+// SampleHistory::Samples
+//
+//*****************************************************************************
+unsigned long long SampleHistory::Samples() const
+{
+	return samples.load(std::memory_order_relaxed);
+}
+
+//*****************************************************************************
+// SampleHistory::Bytes
+//
+// Memory in use, whole blocks
+//*****************************************************************************
+unsigned long long SampleHistory::Bytes() const
+{
+	return (unsigned long long)blocks.load(std::memory_order_relaxed) * sizeof(HistoryBlock);
+}
+
+//*****************************************************************************
+// HopSummary::Clear
+//
+//*****************************************************************************
+void HopSummary::Clear()
+{
+	xmit = returned = total = 0;
+	best = worst = 0;
+	n = 0;
+	mean = m2 = 0;
+	memset(hist, 0, sizeof(hist));
+}
+
+//*****************************************************************************
+// HopSummary::Merge
+//
+//*****************************************************************************
+void HopSummary::Merge(const HopSummary& o)
+{
+	if(o.returned && (!returned || o.best < best)) best = o.best;
+	if(o.worst > worst) worst = o.worst;
+	xmit += o.xmit;
+	returned += o.returned;
+	total += o.total;
+	if(o.n) {
+		double delta = o.mean - mean;
+		unsigned long long sum = n + o.n;
+		mean += delta * o.n / sum;
+		m2 += o.m2 + delta * delta * ((double)n * o.n / sum);
+		n = sum;
+	}
+	for(int b = 0; b < HIST_BUCKETS; ++b)
+		hist[b] += o.hist[b];
+}
+
+//*****************************************************************************
+// HopSummary::Percent
+//
+// Loss
+//*****************************************************************************
+int HopSummary::Percent() const
+{
+	return xmit ? (int)(100 - 100 * returned / xmit) : 0;
+}
+
+//*****************************************************************************
+// HopSummary::Avg
+//
+//*****************************************************************************
+int HopSummary::Avg() const
+{
+	return FixedAvg(total, returned);
+}
+
+//*****************************************************************************
+// HopSummary::StdDev
+//
+//*****************************************************************************
+double HopSummary::StdDev() const
+{
+	return n > 1 ? sqrt(m2 / (n - 1)) : 0;
+}
+
+//*****************************************************************************
+// HopSummary::Serialize
+//
+// The histogram as bucket:count for the non empty buckets
+//*****************************************************************************
+std::string HopSummary::Serialize() const
+{
+	char buf[256];
+	snprintf(buf, sizeof(buf), "xmit=%llu returned=%llu total=%llu best=%d worst=%d n=%llu mean=%.17g m2=%.17g hist=",
+		xmit, returned, total, best, worst, n, mean, m2);
+	std::string line = buf;
+	bool first = true;
+	for(int b = 0; b < HIST_BUCKETS; ++b) {
+		if(!hist[b]) continue;
+		snprintf(buf, sizeof(buf), first ? "%d:%llu" : ",%d:%llu", b, hist[b]);
+		line += buf;
+		first = false;
+	}
+	static const int pct[4] = { 50, 90, 95, 99 };
+	int pval[4];
+	LatencyHistogram::Percentiles(hist, pct, 4, pval);
+	snprintf(buf, sizeof(buf), " loss=%d avg=%d p50=%d p90=%d p95=%d p99=%d stddev=%.1f",
+		Percent(), Avg(), pval[0], pval[1], pval[2], pval[3], StdDev());
+	line += buf;
+	return line;
+}
+
+//*****************************************************************************
+// HopSummary::Parse
+//
+// False unless every serialized field is there
+//*****************************************************************************
+bool HopSummary::Parse(const char* line)
+{
+	Clear();
+	int fields = 0;
+	for(const char* p = line; *p; ) {
+		while(*p == ' ' || *p == '\t') ++p;
+		const char* eq = strchr(p, '=');
+		if(!eq) break;
+		std::string key(p, eq - p);
+		const char* v = eq + 1;
+		if(key == "xmit") { xmit = strtoull(v, NULL, 10); ++fields; }
+		else if(key == "returned") { returned = strtoull(v, NULL, 10); ++fields; }
+		else if(key == "total") { total = strtoull(v, NULL, 10); ++fields; }
+		else if(key == "best") { best = atoi(v); ++fields; }
+		else if(key == "worst") { worst = atoi(v); ++fields; }
+		else if(key == "n") { n = strtoull(v, NULL, 10); ++fields; }
+		else if(key == "mean") { mean = strtod(v, NULL); ++fields; }
+		else if(key == "m2") { m2 = strtod(v, NULL); ++fields; }
+		else if(key == "hist") {
+			++fields;
+			while(*v >= '0' && *v <= '9') {
+				char* end;
+				long b = strtol(v, &end, 10);
+				if(*end != ':' || b < 0 || b >= HIST_BUCKETS) return false;
+				hist[b] = strtoull(end + 1, &end, 10);
+				v = *end == ',' ? end + 1 : end;
+			}
+		}
+		p = strchr(v, ' ');
+		if(!p) break;
+	}
+	return fields == 9;
+}
@@ -0,0 +1,393 @@
+//*****************************************************************************
+// FILE:            WinMTRStats.h
+//
+//
+// DESCRIPTION:
+//   Online per-hop statistics, updated by the probe thread of the hop as
+//   replies come in.
+//
+// NOTES:
+//   Each object has a single writer thread, which also resets it; other
+//   threads read it through the const members without locking, inside the
+//   writer's seqlock where the class says so.
+//
+//*****************************************************************************
+
+#ifndef WINMTRSTATS_H_
+#define WINMTRSTATS_H_
+
+#define RTT_FIXED_SHIFT		8		// RTT sums are kept in 1/256 ms
+
+#define HIST_SUB_BUCKETS	64		// values below are exact, then HIST_SUB_BUCKETS/2 buckets per octave (~3%)
+#define HIST_OCTAVES		10		// up to 2^16 ms, larger values land in the last bucket
+#define HIST_BUCKETS		(HIST_SUB_BUCKETS + HIST_OCTAVES * HIST_SUB_BUCKETS / 2)
+
+#define BURST_BUCKETS		8		// loss runs of 1 .. BURST_BUCKETS-1 probes, then longer ones
+
+#define CHANGE_WARMUP		16		// probes before change detection starts
+#define CHANGE_CUSUM_K		0.5		// CUSUM slack, in mean absolute deviations
+#define CHANGE_CUSUM_H		12.0	// CUSUM alarm threshold, same unit
+#define CHANGE_CLIP			3.0		// largest deviation a single probe adds, same unit
+#define CHANGE_SETTLE		8		// replies measuring the new level after an alarm, at most CHANGE_WARMUP
+#define CHANGE_MIN_STEP		5		// ms, smaller latency steps are not reported
+#define CHANGE_ONSET_RATE	0.20	// smoothed loss rate that starts a loss episode
+#define CHANGE_CLEAR_RATE	0.05	// and the one that ends it
+
+#define SPIKE_WARMUP		16		// replies before spikes are flagged
+#define SPIKE_K				4.0		// a spike is that many mean absolute deviations above the level
+#define SPIKE_MIN_STEP		10		// ms, and at least that much
+
+#define RATE_CALM_SECONDS	10		// a hurried hop halves its probe rate after this long without trouble
+#define RATE_MAX_SECONDS	120		// lasting trouble keeps the fastest rate that long, then only new trouble does
+
+#define HISTORY_BLOCK_WORDS	511		// 64-bit words per history block, ~4 KB with the header
+
+#define WINDOW_SLOTS		30		// ring buckets per sliding window
+#define NR_WINDOWS			3
+
+const int WINDOW_SECONDS[ NR_WINDOWS ] = { 10, 60, 300 };
+const char WINDOW_NAMES[ NR_WINDOWS + 1 ][10] = { "Total", "10 s", "1 min", "5 min" };
+
+// Writer thread only: a plain load/store instead of a locked add
+template<class T> inline void WriterAdd(std::atomic<T>& c, T v)
+{
+	c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+// Mean RTT in ms, rounded, of n replies summing to total (RTT_FIXED_SHIFT)
+inline int FixedAvg(unsigned long long total, unsigned long long n)
+{
+	return n ? (int)((total / n + (1 << (RTT_FIXED_SHIFT - 1))) >> RTT_FIXED_SHIFT) : 0;
+}
+
+//*****************************************************************************
+// CLASS:  EchoCounters
+//
+// Probes sent and answered, RTT sum (fixed point, RTT_FIXED_SHIFT), last,
+// best and worst RTT of a hop since the trace (or a reset) started: 64-bit
+// throughout, so they don't wrap in any real session. Readers on other
+// threads need the writer's seqlock around Read() to get counts from the
+// same probe.
+//*****************************************************************************
+
+class EchoCounters
+{
+public:
+	void	Reset();
+	void	AddSent();
+	void	AddReply(int ms);
+	void	Read(unsigned long long* sent, unsigned long long* recv, unsigned long long* total, int* last, int* best, int* worst) const;
+
+private:
+	std::atomic<unsigned long long>	xmit;
+	std::atomic<unsigned long long>	returned;
+	std::atomic<unsigned long long>	sum;
+	std::atomic<int>	last_ms;
+	std::atomic<int>	best_ms;
+	std::atomic<int>	worst_ms;
+};
+
+//*****************************************************************************
+// CLASS:  LatencyHistogram
+//
+// Log-linear histogram of RTTs in ms (HDR histogram layout): fixed memory,
+// constant time per sample, percentiles within the bucket resolution.
+// Readers on other threads need the writer's seqlock around Read() to get
+// counts from the same sample.
+//*****************************************************************************
+
+class LatencyHistogram
+{
+public:
+	void	Reset();
+	void	Add(int ms);
+	int		Percentile(int pct) const;
+	void	Percentiles(const int* pct, int n, int* out) const;
+	void	Read(unsigned long long* out) const;
+	static void	Percentiles(const unsigned long long* counts, const int* pct, int n, int* out);
+
+private:
+	static int	Bucket(int ms);
+	static int	Value(int bucket);
+
+	std::atomic<unsigned long long>	counts[HIST_BUCKETS];
+};
+
+//*****************************************************************************
+// CLASS:  RunningStats
+//
+// Mean and standard deviation (Welford) and interarrival jitter (RFC 3550,
+// on consecutive RTTs), O(1) per sample. Readers on other threads need the
+// writer's seqlock around Read() to get values from the same sample.
+//*****************************************************************************
+
+class RunningStats
+{
+public:
+	void	Reset();
+	void	Add(int ms);
+	void	Read(double* mean, double* stddev, double* jitter) const;
+	void	ReadMoments(unsigned long long* n, double* mean, double* m2) const;
+
+private:
+	std::atomic<unsigned long long>	count;
+	std::atomic<int>		prev;		// previous sample, for jitter
+	std::atomic<double>		mean;
+	std::atomic<double>		m2;			// sum of squared distances to the mean
+	std::atomic<double>		jitter;
+};
+
+//*****************************************************************************
+// CLASS:  SlidingWindow
+//
+// Sent / received / RTT sum over the last few seconds, in a ring of time
+// slices. Totals are kept up to date as slices expire, so reading is O(1).
+// Times are in ms from any monotonic clock. Readers on other threads need
+// the writer's seqlock around Read() to get values from the same sample.
+//*****************************************************************************
+
+class SlidingWindow
+{
+public:
+	void	Reset(int seconds);
+	void	AddSent(unsigned long long now);
+	void	AddReply(unsigned long long now, int ms);
+	void	Read(long long* sent, long long* recv, int* avg) const;
+
+private:
+	void	Advance(unsigned long long now);
+
+	int					slots;			// slices in use, at most WINDOW_SLOTS
+	unsigned			slice_ms;
+	unsigned long long	current;		// slice number (now / slice_ms) of the newest slot
+	long long			slot_sent[WINDOW_SLOTS];// private to the writer
+	long long			slot_recv[WINDOW_SLOTS];
+	long long			slot_sum[WINDOW_SLOTS];
+	std::atomic<long long>	sent;
+	std::atomic<long long>	recv;
+	std::atomic<long long>	sum;
+};
+
+enum CHANGE_EVENTS {
+	CHANGE_NONE,
+	CHANGE_LATENCY_UP,
+	CHANGE_LATENCY_DOWN,
+	CHANGE_LOSS_ONSET,
+	CHANGE_LOSS_CLEARED,
+	CHANGE_BASELINE_SLOW,	// live samples vs the hop baseline, see WinMTRBaseline.h
+	CHANGE_BASELINE_LOSS,
+	CHANGE_BASELINE_NORMAL,
+	CHANGE_ALERT_RAISED,	// threshold rules, see WinMTRAlert.h
+	CHANGE_ALERT_CLEARED,
+	CHANGE_SPIKE			// destination spike, first seen at the hop, see WinMTRNet::CloseRounds
+};
+
+const char CHANGE_NAMES[][20] = { "", "latency up", "latency down", "loss onset", "loss cleared", "slow vs baseline", "lossy vs baseline", "back to baseline", "alert", "alert cleared", "destination spike" };
+
+// Loss pattern of a hop, see LossPattern::Read
+struct LossSummary {
+	unsigned long long	bursts[BURST_BUCKETS];	// ended loss runs by length, the last bucket holds longer ones
+	unsigned long long	nr_bursts;		// loss runs, the current one included
+	int		longest;		// longest loss run
+	double	mean_burst;		// mean loss run length
+	double	ge_p;			// Gilbert-Elliott: good -> bad state transition probability
+	double	ge_r;			// bad -> good state transition probability
+	double	ge_h;			// probability that a probe gets through in the bad state
+};
+
+//*****************************************************************************
+// CLASS:  LossPattern
+//
+// Runs of consecutive lost probes and a Gilbert-Elliott model fitted to them,
+// O(1) per probe. Random loss reads as ge_p + ge_r close to 1 with short
+// runs; congestion or a flapping link as a small ge_r and long runs.
+// Readers on other threads need the writer's seqlock around Read() to get
+// values from the same probe.
+//*****************************************************************************
+
+class LossPattern
+{
+public:
+	void	Reset();
+	void	Add(bool lost);
+	void	Read(LossSummary* out) const;
+
+private:
+	static int	Bucket(int run);
+
+	unsigned	history;		// last outcomes, bit 0 newest (1 = lost), private to the writer
+	int			run;			// length of the current loss run, private to the writer
+	std::atomic<unsigned long long>	probes;
+	std::atomic<unsigned long long>	lost;		// P(1) = lost / probes
+	std::atomic<unsigned long long>	lost2;		// "11" pairs, P(1|1) = lost2 / lost
+	std::atomic<unsigned long long>	lost_x;		// "1x1" triples, P(1|1x1) = lost3 / lost_x
+	std::atomic<unsigned long long>	lost3;		// "111" triples
+	std::atomic<unsigned long long>	starts;		// loss runs begun
+	std::atomic<int>				longest;
+	std::atomic<unsigned long long>	bursts[BURST_BUCKETS];
+};
+
+//*****************************************************************************
+// CLASS:  ChangeDetector
+//
+// Online change points of one hop: two-sided CUSUM of the RTT against a slow
+// EWMA baseline, scaled by the EWMA of the absolute deviation, and an EWMA
+// loss rate with onset / clear hysteresis. A few operations per probe.
+// Entirely private to the writer thread; only the events it returns leave it.
+//*****************************************************************************
+
+class ChangeDetector
+{
+public:
+	void	Reset();
+	int		Add(int ms, int* before, int* after);
+	bool	Settling() const { return pending != CHANGE_NONE; }	// a latency step is being measured
+	bool	Lossy() const { return lossy; }
+
+private:
+	int		probes;
+	int		replies;
+	int		settle;			// replies left before the CUSUM restarts
+	int		pending;		// CHANGE_EVENTS value to report when settled
+	double	pending_from;	// level before that change
+	double	base;			// reference level: median when settled, then a slow EWMA
+	double	dev;			// EWMA of |RTT - base|
+	int		level[CHANGE_WARMUP];	// RTTs while settling
+	double	up;				// CUSUM statistics
+	double	down;
+	double	loss;			// EWMA of the loss rate
+	bool	lossy;			// inside a loss episode
+};
+
+//*****************************************************************************
+// CLASS:  SpikeDetector
+//
+// Flags single probes far above the usual RTT of a hop. The level and the
+// mean absolute deviation follow the replies with clipped updates, so
+// spikes barely move them while a lasting step is absorbed in a few dozen
+// probes.
+//*****************************************************************************
+
+class SpikeDetector
+{
+public:
+	void	Reset();
+	bool	Add(int ms);
+	int		Level() const { return (int)(level + 0.5); }
+
+private:
+	int		replies;
+	double	level;			// ms
+	double	dev;			// EWMA of |RTT - level|
+};
+
+//*****************************************************************************
+// CLASS:  ProbeRate
+//
+// Probe interval of a hop: the configured one while the hop is quiet, down
+// to the fastest allowed as soon as trouble starts (loss onset, latency
+// step, baseline deviation, alert), then doubling back every
+// RATE_CALM_SECONDS once it is over. The interval is base >> shift, so a new
+// base interval applies at once. Written by the probe thread of the hop,
+// Interval() may be read by any thread.
+//*****************************************************************************
+
+class ProbeRate
+{
+public:
+	void		Reset();
+	void		Update(bool trouble, bool lasting, unsigned base, unsigned fastest, unsigned long long now);
+	unsigned	Interval(unsigned base, unsigned fastest) const;
+
+private:
+	std::atomic<int>	shift;		// halvings of the base interval, 0 when quiet
+	unsigned long long	since;		// ms, start of the hurry
+	unsigned long long	calm;		// ms, last time there was trouble
+};
+
+//*****************************************************************************
+// CLASS:  HopSummary
+//
+// Plain copy of the mergeable statistics of a hop: counts, fixed point RTT
+// sum, min / max, RTT moments and the latency histogram. Summaries of the
+// same hop from several sessions or sites merge exactly (moments with Chan's
+// formula, histograms bucket by bucket), so percentiles and loss of the
+// aggregate are computed from the merged data, not averaged. Serialized as
+// one line of key=value pairs; derived values follow for the reader and are
+// ignored by Parse().
+//*****************************************************************************
+
+class HopSummary
+{
+public:
+	void	Clear();
+	void	Merge(const HopSummary& other);
+	std::string	Serialize() const;
+	bool	Parse(const char* line);
+
+	int		Percent() const;
+	int		Avg() const;
+	double	StdDev() const;
+
+	unsigned long long	xmit;
+	unsigned long long	returned;
+	unsigned long long	total;		// RTT sum, fixed point (RTT_FIXED_SHIFT)
+	int		best;
+	int		worst;
+	unsigned long long	n;			// RTT moments, see RunningStats
+	double	mean;
+	double	m2;
+	unsigned long long	hist[HIST_BUCKETS];	// see LatencyHistogram
+};
+
+// One probe of the full history, see SampleHistory::Decode
+struct HistoryPoint {
+	long long	time;		// ms since 1970-01-01 UTC
+	int			rtt;		// ms, -1 if lost
+};
+
+// Compressed samples, see SampleHistory
+struct HistoryBlock {
+	std::atomic<HistoryBlock*>		next;
+	std::atomic<unsigned>			bits;		// bits holding complete samples
+	std::atomic<unsigned long long>	words[HISTORY_BLOCK_WORDS];
+};
+
+//*****************************************************************************
+// CLASS:  SampleHistory
+//
+// Every probe of a hop, compressed the Gorilla way: delta-of-delta encoded
+// timestamps and XOR encoded values, a few bytes per probe. Blocks are
+// appended, never changed below their published bit count, so readers
+// decode them while the writer goes on. No constructor or destructor:
+// Init() first, Clear() before releasing it.
+//*****************************************************************************
+
+class SampleHistory
+{
+public:
+	void	Init();
+	void	Clear();
+	void	Add(long long time, int rtt);
+	int		Decode(std::vector<HistoryPoint>& out) const;
+	unsigned long long	Samples() const;
+	unsigned long long	Bytes() const;
+
+private:
+	void	Put(unsigned long long v, int n);
+	void	NewBlock();
+	static unsigned long long	Get(const HistoryBlock* b, unsigned* pos, int n);
+
+	std::atomic<HistoryBlock*>		head;
+	std::atomic<unsigned long long>	samples;
+	std::atomic<unsigned>			blocks;
+	HistoryBlock*	tail;			// the rest is private to the writer
+	unsigned		pos;			// bits used in tail
+	long long		prev_time;
+	long long		prev_delta;
+	unsigned		prev_value;
+	int				lead;			// leading / trailing zero bits of the last XOR window
+	int				trail;
+};
+
+#endif // ifndef WINMTRSTATS_H_
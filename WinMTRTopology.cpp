@@ -0,0 +1,238 @@
+//*****************************************************************************
+// FILE:            WinMTRTopology.cpp
+//
+//*****************************************************************************
+#include "pch.h"
+#include "WinMTRGlobal.h"
+#include "WinMTRNet.h"
+#include "WinMTRTopology.h"
+#include <algorithm>
+
+TopologyGraph topology;
+
+TopologyGraph::TopologyGraph()
+{
+	InitializeSRWLock(&lock);
+}
+
+TopologyGraph::~TopologyGraph()
+{
+	Clear();
+}
+
+// moves an average shared by several writers 1 / 2^shift of the way to v
+static void Ewma(std::atomic<double>& avg, double v, int shift)
+{
+	double old = avg.load(std::memory_order_relaxed);
+	while(!avg.compare_exchange_weak(old, old + (v - old) / (1 << shift), std::memory_order_relaxed))
+		;
+}
+
+//*****************************************************************************
+// TopologyGraph::Add
+//
+// One probe crossing the link from -> to for the trace of target. rtt is the
+// far end RTT (-1: lost), near_rtt the last one of the near end (-1: none,
+// the added latency is then not measured). The counters are atomic and
+// updated under the shared lock, which keeps Clear() away; the exclusive
+// lock is taken only by the first probe of a link, or of a trace over it.
+//*****************************************************************************
+void TopologyGraph::Add(unsigned from, unsigned to, unsigned target, int rtt, int near_rtt)
+{
+	unsigned long long key = (unsigned long long)from << 32 | to;
+	AcquireSRWLockShared(&lock);
+	std::unordered_map<unsigned long long, s_linkstate*>::const_iterator it = links.find(key);
+	s_linkstate* l = it == links.end() ? NULL : it->second;
+	if(!l || !l->destinations.count(target)) {
+		ReleaseSRWLockShared(&lock);
+		AcquireSRWLockExclusive(&lock);
+		s_linkstate*& p = links[key];
+		if(!p) {
+			p = new s_linkstate;
+			p->xmit = p->returned = p->rtt_total = p->deltas = 0;
+			p->delta_total = 0;
+			p->recent_loss = p->recent_delta = 0;
+		}
+		p->destinations.insert(target);
+		ReleaseSRWLockExclusive(&lock);
+		AcquireSRWLockShared(&lock);
+		it = links.find(key);
+		l = it == links.end() ? NULL : it->second;
+		if(!l) {// cleared meanwhile
+			ReleaseSRWLockShared(&lock);
+			return;
+		}
+	}
+	l->xmit.fetch_add(1, std::memory_order_relaxed);
+	Ewma(l->recent_loss, rtt < 0 ? 1.0 : 0.0, LINK_EWMA_SHIFT);
+	if(rtt >= 0) {
+		l->returned.fetch_add(1, std::memory_order_relaxed);
+		l->rtt_total.fetch_add(rtt, std::memory_order_relaxed);
+		if(near_rtt >= 0) {
+			l->delta_total.fetch_add(rtt - near_rtt, std::memory_order_relaxed);
+			unsigned long long n = l->deltas.fetch_add(1, std::memory_order_relaxed);
+			Ewma(l->recent_delta, rtt - near_rtt, n < (1 << LINK_EWMA_SHIFT) ? 0 : LINK_EWMA_SHIFT);
+		}
+	}
+	ReleaseSRWLockShared(&lock);
+}
+
+void TopologyGraph::SetName(unsigned id, const char* name)
+{
+	if(!id) return;
+	AcquireSRWLockExclusive(&lock);
+	names[id] = name;
+	ReleaseSRWLockExclusive(&lock);
+}
+
+void TopologyGraph::Clear()
+{
+	AcquireSRWLockExclusive(&lock);
+	for(std::unordered_map<unsigned long long, s_linkstate*>::iterator it = links.begin(); it != links.end(); ++it)
+		delete it->second;
+	links.clear();
+	ReleaseSRWLockExclusive(&lock);
+}
+
+//*****************************************************************************
+// TopologyGraph::GetLinks
+//
+// Copy of every link, sorted by near then far end. The counters of a link
+// being probed may be a probe apart from each other.
+//*****************************************************************************
+int TopologyGraph::GetLinks(std::vector<s_toplink>& out)
+{
+	AcquireSRWLockShared(&lock);
+	out.clear();
+	out.reserve(links.size());
+	for(std::unordered_map<unsigned long long, s_linkstate*>::const_iterator it = links.begin(); it != links.end(); ++it) {
+		const s_linkstate& l = *it->second;
+		s_toplink k;
+		k.from = (unsigned)(it->first >> 32);
+		k.to = (unsigned)it->first;
+		k.xmit = l.xmit.load(std::memory_order_relaxed);
+		k.returned = l.returned.load(std::memory_order_relaxed);
+		k.rtt_total = l.rtt_total.load(std::memory_order_relaxed);
+		k.delta_total = l.delta_total.load(std::memory_order_relaxed);
+		k.deltas = l.deltas.load(std::memory_order_relaxed);
+		k.recent_loss = l.recent_loss.load(std::memory_order_relaxed);
+		k.recent_delta = l.recent_delta.load(std::memory_order_relaxed);
+		k.destinations.assign(l.destinations.begin(), l.destinations.end());
+		std::sort(k.destinations.begin(), k.destinations.end());
+		out.push_back(k);
+	}
+	ReleaseSRWLockShared(&lock);
+	std::sort(out.begin(), out.end(), [](const s_toplink& a, const s_toplink& b) {
+		return a.from != b.from ? a.from < b.from : a.to < b.to;
+	});
+	return (int)out.size();
+}
+
+std::string TopologyGraph::Address(unsigned id)
+{
+	char buf[NI_MAXHOST];
+	if(!id) return "this host";
+	if(getnameinfo(addresses.Get(id), sizeof(sockaddr_in6), buf, NI_MAXHOST, NULL, 0, NI_NUMERICHOST))
+		return "?";
+	return buf;
+}
+
+std::string TopologyGraph::Name(unsigned id)
+{
+	AcquireSRWLockShared(&lock);
+	std::unordered_map<unsigned, std::string>::const_iterator it = names.find(id);
+	std::string name = it != names.end() ? it->second : "";
+	ReleaseSRWLockShared(&lock);
+	return name;
+}
+
+// escapes a string for a quoted GraphViz ID or a JSON string
+static std::string Quote(const std::string& s)
+{
+	std::string q = "\"";
+	for(size_t i = 0; i < s.size(); ++i) {
+		if(s[i] == '\n') q += "\\n";
+		else if(s[i] == '"' || s[i] == '\\') q += std::string("\\") + s[i];
+		else if((unsigned char)s[i] >= ' ') q += s[i];
+	}
+	return q + "\"";
+}
+
+//*****************************************************************************
+// TopologyGraph::ToGraphViz
+//
+// DOT digraph: one box per responder, one edge per link labelled with its
+// latency, loss and the number of destinations crossing it. Links shared by
+// several destinations are drawn thicker, lossy ones in orange / red.
+//*****************************************************************************
+std::string TopologyGraph::ToGraphViz()
+{
+	std::vector<s_toplink> l;
+	GetLinks(l);
+	std::vector<unsigned> nodes;
+	for(size_t i = 0; i < l.size(); ++i) {
+		nodes.push_back(l[i].from);
+		nodes.push_back(l[i].to);
+	}
+	std::sort(nodes.begin(), nodes.end());
+	nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+	std::string dot = "digraph winmtr {\n\trankdir=LR;\n\tnode [shape=box, fontname=\"Arial\"];\n\tedge [fontname=\"Arial\", fontsize=10];\n";
+	char buf[256];
+	for(size_t i = 0; i < nodes.size(); ++i) {
+		std::string label = Address(nodes[i]), name = Name(nodes[i]);
+		if(!name.empty() && name != label) label += "\n" + name;
+		sprintf(buf, "\tn%u [label=", nodes[i]);
+		dot += buf + Quote(label) + "];\n";
+	}
+	for(size_t i = 0; i < l.size(); ++i) {
+		int loss = (int)(l[i].recent_loss * 100 + 0.5);
+		sprintf(buf, "\tn%u -> n%u [label=\"%d ms / %d%% / %d dst\", penwidth=%d%s];\n",
+			l[i].from, l[i].to, (int)(l[i].recent_delta + 0.5), loss, (int)l[i].destinations.size(),
+			(int)(l[i].destinations.size() < 8 ? l[i].destinations.size() : 8),
+			loss >= LINK_BAD_LOSS ? ", color=red" : loss >= LINK_WARN_LOSS ? ", color=orange" : "");
+		dot += buf;
+	}
+	return dot + "}\n";
+}
+
+//*****************************************************************************
+// TopologyGraph::ToJson
+//
+// {"nodes": [{id, address, name}], "links": [{from, to, counters,
+// recent loss / latency, destinations}]}
+//*****************************************************************************
+std::string TopologyGraph::ToJson()
+{
+	std::vector<s_toplink> l;
+	GetLinks(l);
+	std::vector<unsigned> nodes;
+	for(size_t i = 0; i < l.size(); ++i) {
+		nodes.push_back(l[i].from);
+		nodes.push_back(l[i].to);
+	}
+	std::sort(nodes.begin(), nodes.end());
+	nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+	std::string json = "{\n\"nodes\": [";
+	char buf[512];
+	for(size_t i = 0; i < nodes.size(); ++i) {
+		sprintf(buf, "%s\n\t{\"id\": %u, \"address\": ", i ? "," : "", nodes[i]);
+		json += buf + Quote(nodes[i] ? Address(nodes[i]) : "") + ", \"name\": " + Quote(Name(nodes[i])) + "}";
+	}
+	json += "\n],\n\"links\": [";
+	for(size_t i = 0; i < l.size(); ++i) {
+		const s_toplink& k = l[i];
+		sprintf(buf, "%s\n\t{\"from\": %u, \"to\": %u, \"sent\": %llu, \"received\": %llu, \"loss\": %.1f, \"avg\": %.1f, \"delta\": %.1f, \"recent_loss\": %.1f, \"recent_delta\": %.1f, \"destinations\": [",
+			i ? "," : "", k.from, k.to, k.xmit, k.returned,
+			k.xmit ? (double)(k.xmit - k.returned) * 100 / k.xmit : 0.0,
+			k.returned ? (double)k.rtt_total / k.returned : 0.0,
+			k.deltas ? (double)k.delta_total / k.deltas : 0.0,
+			k.recent_loss * 100, k.recent_delta);
+		json += buf;
+		for(size_t d = 0; d < k.destinations.size(); ++d)
+			json += (d ? ", " : "") + Quote(Address(k.destinations[d]));
+		json += "]}";
+	}
+	return json + "\n]\n}\n";
+}
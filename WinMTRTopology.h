@@ -0,0 +1,83 @@
+//*****************************************************************************
+// FILE:            WinMTRTopology.h
+//
+//
+// DESCRIPTION:
+//   Graph of the links seen by every trace of the process: responder to
+//   next responder, with the latency and loss measured across each link.
+//
+// NOTES:
+//   Nodes are AddressTable ids, 0 stands for this host. Links are updated
+//   by the probe threads as samples come in, with atomic counters; the
+//   graph lock is taken exclusively only to add a link or a destination
+//   to one, shared otherwise.
+//
+//*****************************************************************************
+
+#ifndef WINMTRTOPOLOGY_H_
+#define WINMTRTOPOLOGY_H_
+
+#include <unordered_map>
+#include <unordered_set>
+
+#define LINK_EWMA_SHIFT		4		// recent loss / latency average over ~16 probes
+#define LINK_WARN_LOSS		5		// %, recent link loss drawn in orange
+#define LINK_BAD_LOSS		20		// %, and in red
+
+// Copy of one directed link, see TopologyGraph::GetLinks
+struct s_toplink {
+	unsigned from;				// AddressTable ids, from 0: this host
+	unsigned to;
+	unsigned long long xmit;	// probes sent to the far end
+	unsigned long long returned;
+	unsigned long long rtt_total;	// ms, RTT of the far end
+	long long delta_total;		// ms, far end RTT minus the near end one
+	unsigned long long deltas;	// samples in delta_total
+	double recent_loss;			// smoothed lost probes, 0..1
+	double recent_delta;		// smoothed latency added by the link, ms
+	std::vector<unsigned> destinations;	// targets of the traces crossing the link
+};
+
+// Live state of a link, see TopologyGraph::Add
+struct s_linkstate {
+	std::atomic<unsigned long long> xmit;
+	std::atomic<unsigned long long> returned;
+	std::atomic<unsigned long long> rtt_total;
+	std::atomic<long long> delta_total;
+	std::atomic<unsigned long long> deltas;
+	std::atomic<double> recent_loss;
+	std::atomic<double> recent_delta;
+	std::unordered_set<unsigned> destinations;	// changed under the exclusive graph lock
+};
+
+//*****************************************************************************
+// CLASS:  TopologyGraph
+//
+//
+//*****************************************************************************
+
+class TopologyGraph
+{
+public:
+	TopologyGraph();
+	~TopologyGraph();
+
+	void	Add(unsigned from, unsigned to, unsigned target, int rtt, int near_rtt);
+	void	SetName(unsigned id, const char* name);
+	void	Clear();
+	int		GetLinks(std::vector<s_toplink>& out);
+	std::string	ToGraphViz();
+	std::string	ToJson();
+
+private:
+	static std::string Address(unsigned id);
+	std::string Name(unsigned id);
+
+	SRWLOCK				lock;
+	std::unordered_map<unsigned long long, s_linkstate*>	links;	// key from << 32 | to
+	std::unordered_map<unsigned, std::string>		names;	// resolved host names of the nodes
+};
+
+extern TopologyGraph topology;
+
+#endif	// ifndef WINMTRTOPOLOGY_H_
@@ -9,6 +9,8 @@
 
 #include <string>
 #include <list>
+#include <vector>
+#include <atomic>
 
 #define WINMTR_DIALOG_TIMER 100
 #define TIMER_DELAY 1000 * 60 // 1 minute
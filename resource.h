@@ -40,6 +40,17 @@
 #define IDC_COMBO_HOST                  1024
 #define IDC_EDIT_MAX_LRU                1025
 #define IDC_CHECK_IPV6                  1026
+#define IDC_CHECK_TSTAMP                1027
+#define IDC_LIST_MTR2                   1028
+#define IDC_CHECK_DUAL                  1029
+#define IDC_COMBO_TRACE                 1030
+#define IDC_EDIT_FANOUT                 1031
+#define IDC_EDIT_DSCP                   1032
+#define IDC_COMBO_WINDOW                1033
+#define IDC_EDIT_PRECENT                1034
+#define IDC_EDIT_PLOSSPATTERN           1035
+#define IDC_BUTTON_PHISTORY             1036
+#define IDC_STATIC_PHISTORY             1037
 
 // Next default values for new objects
 // 
@@ -47,7 +58,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        135
 #define _APS_NEXT_COMMAND_VALUE         32771
-#define _APS_NEXT_CONTROL_VALUE         1027
+#define _APS_NEXT_CONTROL_VALUE         1038
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
@@ -0,0 +1,28 @@
+//*****************************************************************************
+// FILE:            TestPch.h
+//
+//
+// DESCRIPTION:
+//   Stands in for pch.h when the portable sources are built outside of the
+//   MFC project: the standard headers they rely on, the few Windows names
+//   they use, and PCH_H defined so the real pch.h (framework.h, MFC) is
+//   skipped.
+//
+//*****************************************************************************
+
+#ifndef TESTPCH_H_
+#define TESTPCH_H_
+
+#define PCH_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+// a pause instruction on Windows; a yield here, so that a spinning reader
+// doesn't starve the writers of a machine with few cores
+#define YieldProcessor() std::this_thread::yield()
+
+#endif // ifndef TESTPCH_H_
@@ -0,0 +1,217 @@
+//*****************************************************************************
+// FILE:            WinMTRBench.cpp
+//
+//
+// DESCRIPTION:
+//   Console benchmark of the per-hop counters of WinMTRHop.h, see
+//   tests/CMakeLists.txt.
+//   Usage: WinMTRBench [contention | sharing] [seconds per case, default 2]
+//
+// NOTES:
+//   MAX_HOPS probe threads, each updating the s_hopstats of its own hop as
+//   fast as it can, with the updates of WinMTRNet::AddXmit / AddReply:
+//     contention  every update under one mutex (the ghMutex scheme the
+//                 counters had before) vs the single writer seqlocks, with
+//                 one reader thread copying every hop in a loop meanwhile
+//     sharing     seqlocks, plus a timestamp thread per hop and a listener
+//                 thread writing the other groups of the same s_hopstats;
+//                 WinMTRBenchPacked runs it with the groups packed
+//                 (HOP_CACHE_LINE 8) to compare with the split layout
+//   Writers yield every 64 probes, the reader never: far more updates and
+//   copies than real probe threads and dialog timers make, so the figures
+//   bound the cost of the schemes, they are not a probing rate. Run it on
+//   a machine with more cores than threads if possible.
+//
+//*****************************************************************************
+
+#include "WinMTRHop.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <mutex>
+
+#define MAX_HOPS		30		// as WinMTRNet.cpp
+
+static std::atomic<bool> running;
+static std::mutex global;
+
+// one probe, sent then answered in rtt ms, as AddXmit and AddReply do it
+template<bool locked> static void Probe(s_hopstats& s, unsigned long long now, int rtt)
+{
+	if(locked) global.lock();
+	else WriteBegin(s.seq);
+	if(s.reset_req.load(std::memory_order_acquire) != s.epoch.load(std::memory_order_relaxed))
+		s.epoch.store(s.reset_req.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	s.echo.AddSent();
+	for(int w = 0; w < NR_WINDOWS; ++w) s.windows[w].AddSent(now);
+	if(locked) global.unlock();
+	else WriteEnd(s.seq);
+
+	if(locked) global.lock();
+	else WriteBegin(s.seq);
+	s.echo.AddReply(rtt);
+	s.rtt_stats.Add(rtt);
+	s.rtt_hist.Add(rtt);
+	for(int w = 0; w < NR_WINDOWS; ++w) s.windows[w].AddReply(now, rtt);
+	s.loss.Add(false);
+	if(locked) global.unlock();
+	else WriteEnd(s.seq);
+	s.has_addr.load(std::memory_order_acquire);// SetAddr
+}
+
+// one timestamp request and its reply, as AddTimestampXmit / UpdateTimestamp
+static void Timestamp(s_hopstats& s, int fwd, int ret)
+{
+	WriteBegin(s.ts_seq);
+	if(s.reset_req.load(std::memory_order_acquire) != s.ts_epoch.load(std::memory_order_relaxed))
+		s.ts_epoch.store(s.reset_req.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	WriterAdd(s.ts_xmit, 1ULL);
+	WriteEnd(s.ts_seq);
+	WriteBegin(s.ts_seq);
+	WriterAdd(s.ts_fwd_total, (long long)fwd);
+	WriterAdd(s.ts_ret_total, (long long)ret);
+	WriterAdd(s.ts_returned, 1ULL);
+	WriteEnd(s.ts_seq);
+}
+
+// the counters of one hop, as ReadCounters copies them
+template<bool locked> static void Copy(s_hopstats& s)
+{
+	unsigned seq = 0;
+	unsigned long long xmit, returned, total, hist[HIST_BUCKETS];
+	int last, best, worst, avg;
+	long long sent, recv;
+	double mean, stddev, jitter;
+	LossSummary loss;
+	if(locked) global.lock();
+	do {
+		if(!locked) seq = ReadBegin(s.seq);
+		s.echo.Read(&xmit, &returned, &total, &last, &best, &worst);
+		s.rtt_stats.Read(&mean, &stddev, &jitter);
+		for(int w = 0; w < NR_WINDOWS; ++w) s.windows[w].Read(&sent, &recv, &avg);
+		s.loss.Read(&loss);
+		s.rtt_hist.Read(hist);
+	} while(!locked && ReadRetry(s.seq, seq));
+	long long ts_returned;
+	do {
+		if(!locked) seq = ReadBegin(s.ts_seq);
+		ts_returned = s.ts_returned.load(std::memory_order_relaxed);
+	} while(!locked && ReadRetry(s.ts_seq, seq));
+	if(locked) global.unlock();
+	s.reply_ttl.load(std::memory_order_relaxed);
+}
+
+template<bool locked> static void Writer(s_hopstats* s, unsigned long long* probes)
+{
+	unsigned long long n = 0;
+	while(running.load(std::memory_order_relaxed)) {
+		for(int i = 0; i < 64; ++i)
+			Probe<locked>(*s, n >> 6, 10 + (int)(n + i) % 7);
+		n += 64;
+		std::this_thread::yield();// as a probe thread waits for its reply, outside the seqlock
+	}
+	*probes = n;
+}
+
+static void TimestampWriter(s_hopstats* s, unsigned long long* probes)
+{
+	unsigned long long n = 0;
+	while(running.load(std::memory_order_relaxed)) {
+		for(int i = 0; i < 64; ++i)
+			Timestamp(*s, 5 + (int)(n + i) % 3, 6);
+		n += 64;
+		std::this_thread::yield();
+	}
+	*probes = n;
+}
+
+static void Listener(s_hopstats* hops, unsigned long long* replies)
+{
+	unsigned long long n = 0;
+	while(running.load(std::memory_order_relaxed)) {
+		for(int i = 0; i < 64; ++i)
+			hops[(n + i) % MAX_HOPS].reply_ttl.store((unsigned char)(64 - (n + i) % MAX_HOPS), std::memory_order_relaxed);
+		n += 64;
+		std::this_thread::yield();
+	}
+	*replies = n;
+}
+
+template<bool locked> static void Reader(s_hopstats* hops, unsigned long long* copies)
+{
+	unsigned long long n = 0;
+	while(running.load(std::memory_order_relaxed)) {
+		for(int at = 0; at < MAX_HOPS; ++at)
+			Copy<locked>(hops[at]);
+		++n;
+	}
+	*copies = n;
+}
+
+//*****************************************************************************
+// Run
+//
+// One case: MAX_HOPS probe threads on hops[], the timestamp and listener
+// threads if sharing, and a reader, for the given time. Prints the probes
+// per second of the probe threads together, the timestamp probes per
+// second, and the copies of the whole path per second of the reader.
+//*****************************************************************************
+template<bool locked> static void Run(const char* name, bool sharing, double seconds)
+{
+	s_hopstats* hops = new s_hopstats[MAX_HOPS]();
+	for(int at = 0; at < MAX_HOPS; ++at) {
+		for(int w = 0; w < NR_WINDOWS; ++w) hops[at].windows[w].Reset(WINDOW_SECONDS[w]);
+		hops[at].rtt_stats.Reset();
+		hops[at].rtt_hist.Reset();
+		hops[at].loss.Reset();
+	}
+	unsigned long long probes[MAX_HOPS], stamps[MAX_HOPS], replies = 0, copies = 0;
+	std::thread threads[MAX_HOPS * 2 + 2];
+	int nt = 0;
+	running = true;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int at = 0; at < MAX_HOPS; ++at)
+		threads[nt++] = std::thread(Writer<locked>, &hops[at], &probes[at]);
+	if(sharing) {
+		for(int at = 0; at < MAX_HOPS; ++at)
+			threads[nt++] = std::thread(TimestampWriter, &hops[at], &stamps[at]);
+		threads[nt++] = std::thread(Listener, hops, &replies);
+	}
+	threads[nt++] = std::thread(Reader<locked>, hops, &copies);
+	std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	running = false;
+	for(int t = 0; t < nt; ++t) threads[t].join();
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	unsigned long long total = 0, ts_total = 0;
+	for(int at = 0; at < MAX_HOPS; ++at) {
+		unsigned long long xmit, returned, sum;
+		int last, best, worst;
+		hops[at].echo.Read(&xmit, &returned, &sum, &last, &best, &worst);
+		total += probes[at];
+		if(xmit != probes[at] || returned != probes[at])
+			fprintf(stderr, "%s: hop %d counted %llu of %llu probes\n", name, at + 1, xmit, probes[at]);
+		if(sharing) ts_total += stamps[at];
+	}
+	printf("%-28s %8.2f M probes/s", name, total / elapsed / 1e6);
+	if(sharing) printf("  %8.2f M timestamps/s", ts_total / elapsed / 1e6);
+	printf("  %8.0f path copies/s\n", copies / elapsed);
+	delete[] hops;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* what = argc > 1 ? argv[1] : "";
+	double seconds = argc > 2 ? atof(argv[2]) : 2;
+	if(seconds <= 0) seconds = 2;
+	printf("%d probe threads, %u hardware threads, s_hopstats of %u bytes, HOP_CACHE_LINE %d, %g s per case\n",
+		MAX_HOPS, std::thread::hardware_concurrency(), (unsigned)sizeof(s_hopstats), HOP_CACHE_LINE, seconds);
+	if(!*what || !strcmp(what, "contention")) {
+		Run<true>("one mutex", false, seconds);
+		Run<false>("seqlocks", false, seconds);
+	}
+	if(!*what || !strcmp(what, "sharing"))
+		Run<false>(HOP_CACHE_LINE >= 64 ? "seqlocks, split groups" : "seqlocks, packed groups", true, seconds);
+	return 0;
+}
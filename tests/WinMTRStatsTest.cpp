@@ -0,0 +1,229 @@
+//*****************************************************************************
+// FILE:            WinMTRStatsTest.cpp
+//
+//
+// DESCRIPTION:
+//   Tests of the per-hop statistics types, see tests/CMakeLists.txt.
+//   Usage: WinMTRStatsTest <test name>, or no argument to run them all.
+//
+//*****************************************************************************
+
+#include "WinMTRStats.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <random>
+
+static int failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } } while(0)
+#define CHECK_EQ(a, b) do { long long va_ = (long long)(a), vb_ = (long long)(b); if(va_ != vb_) { fprintf(stderr, "%s:%d: %s == %lld, expected %s == %lld\n", __FILE__, __LINE__, #a, va_, #b, vb_); ++failures; } } while(0)
+
+//*****************************************************************************
+// TestLongRun
+//
+// More than 2^32 probes through the echo counters and a sliding window, as
+// WinMTRNet::AddXmit / AddReply feed them, then a hop summary: nothing may
+// wrap. One probe in four is lost, the replies take 23, 20 and 23 ms, so
+// the mean is exactly 22 ms.
+//*****************************************************************************
+static void TestLongRun()
+{
+	const unsigned long long N = (1ULL << 32) + 4096;
+	EchoCounters e;
+	e.Reset();
+	SlidingWindow w;
+	w.Reset(WINDOW_SECONDS[NR_WINDOWS - 1]);
+	const unsigned long long now = 1000;	// a single slice of the window
+	for(unsigned long long i = 0; i < N; ++i) {
+		e.AddSent();
+		w.AddSent(now);
+		if((i & 3) == 3) continue;
+		int rtt = (i & 1) ? 20 : 23;
+		e.AddReply(rtt);
+		w.AddReply(now, rtt);
+	}
+
+	long long sent, recv;
+	int avg;
+	w.Read(&sent, &recv, &avg);
+	CHECK_EQ(sent, N);
+	CHECK_EQ(recv, N / 4 * 3);
+	CHECK_EQ(avg, 22);
+
+	HopSummary h;
+	h.Clear();
+	int last;
+	e.Read(&h.xmit, &h.returned, &h.total, &last, &h.best, &h.worst);
+	CHECK_EQ(h.xmit, N);
+	CHECK_EQ(h.returned, N / 4 * 3);
+	CHECK_EQ(h.total, (N / 4 * 66) << RTT_FIXED_SHIFT);
+	CHECK_EQ(last, 23);
+	CHECK_EQ(h.best, 20);
+	CHECK_EQ(h.worst, 23);
+	CHECK_EQ(h.Avg(), 22);
+	CHECK_EQ(h.Percent(), 25);
+
+	HopSummary back;
+	CHECK(back.Parse(h.Serialize().c_str()));
+	CHECK_EQ(back.xmit, h.xmit);
+	CHECK_EQ(back.returned, h.returned);
+	CHECK_EQ(back.total, h.total);
+
+	// the slice expires as a whole
+	w.AddSent(now + WINDOW_SECONDS[NR_WINDOWS - 1] * 1000ULL);
+	w.Read(&sent, &recv, &avg);
+	CHECK_EQ(sent, 1);
+	CHECK_EQ(recv, 0);
+	CHECK_EQ(avg, 0);
+}
+
+//*****************************************************************************
+// TestHistoryRoundTrip
+//
+// A random series decodes exactly as it went in: steady and jittery probe
+// intervals, repeated and backward timestamps, gaps wider than a 32-bit
+// delta of delta, lost probes, RTTs from 0 to a minute, over many blocks.
+//*****************************************************************************
+static void TestHistoryRoundTrip()
+{
+	std::mt19937_64 rng(20260418);
+	std::vector<HistoryPoint> in;
+	long long time = 1776500000000LL;
+	for(int i = 0; i < 300000; ++i) {
+		int kind = (int)(rng() % 100);
+		if(kind < 60) time += 1000;
+		else if(kind < 90) time += 900 + (long long)(rng() % 200);
+		else if(kind < 95) time += (long long)(rng() % 5000);
+		else if(kind < 97) ;
+		else if(kind < 99) time -= (long long)(rng() % 3000);
+		else time += (long long)(rng() % 4000000);
+		if(i % 100000 == 99999) time += 30LL * 24 * 3600 * 1000;// a month without probing
+		int r = (int)(rng() % 100), rtt;
+		if(r < 10) rtt = -1;
+		else if(r < 80) rtt = 20 + (int)(rng() % 5);
+		else if(r < 95) rtt = (int)(rng() % 400);
+		else rtt = (int)(rng() % 60001);
+		HistoryPoint p = { time, rtt };
+		in.push_back(p);
+	}
+
+	SampleHistory h;
+	h.Init();
+	for(size_t i = 0; i < in.size(); ++i)
+		h.Add(in[i].time, in[i].rtt);
+	std::vector<HistoryPoint> out;
+	CHECK_EQ(h.Decode(out), in.size());
+	CHECK_EQ(h.Samples(), in.size());
+	CHECK_EQ(out.size(), in.size());
+	int bad = 0;
+	for(size_t i = 0; i < in.size() && i < out.size(); ++i) {
+		if(out[i].time == in[i].time && out[i].rtt == in[i].rtt) continue;
+		if(!bad++)
+			fprintf(stderr, "sample %zu: %lld %d decoded as %lld %d\n", i, in[i].time, in[i].rtt, out[i].time, out[i].rtt);
+	}
+	CHECK_EQ(bad, 0);
+	CHECK(h.Bytes() < in.size() * sizeof(HistoryPoint));
+	h.Clear();
+}
+
+// summary of probes (-1: lost) counted as a probe thread counts them
+static void Summarize(const int* rtt, size_t n, HopSummary* sum)
+{
+	RunningStats stats;
+	stats.Reset();
+	LatencyHistogram hist;
+	hist.Reset();
+	sum->Clear();
+	for(size_t i = 0; i < n; ++i) {
+		++sum->xmit;
+		if(rtt[i] < 0) continue;
+		if(!sum->returned || rtt[i] < sum->best) sum->best = rtt[i];
+		if(rtt[i] > sum->worst) sum->worst = rtt[i];
+		++sum->returned;
+		sum->total += (unsigned long long)rtt[i] << RTT_FIXED_SHIFT;
+		stats.Add(rtt[i]);
+		hist.Add(rtt[i]);
+	}
+	stats.ReadMoments(&sum->n, &sum->mean, &sum->m2);
+	hist.Read(sum->hist);
+}
+
+static bool Near(double a, double b, double rel)
+{
+	return fabs(a - b) <= rel * (fabs(a) > fabs(b) ? fabs(a) : fabs(b)) + 1e-12;
+}
+
+//*****************************************************************************
+// TestSummaryMerge
+//
+// Summaries of consecutive parts of a random series, serialized, parsed and
+// merged, equal the summary of the whole series: counts, sum, min / max and
+// histogram exactly, moments to rounding. One part is all lost probes.
+//*****************************************************************************
+static void TestSummaryMerge()
+{
+	std::mt19937_64 rng(20260419);
+	std::vector<int> rtt;
+	for(int i = 0; i < 100000; ++i) {
+		int r = (int)(rng() % 100);
+		rtt.push_back(r < 8 ? -1 : r < 90 ? 15 + (int)(rng() % 20) : (int)(rng() % 3000));
+	}
+	for(int i = 0; i < 500; ++i)// a down hop
+		rtt.insert(rtt.begin() + 40000, -1);
+	const size_t cut[] = { 0, 12345, 40000, 40500, 77777, rtt.size() };
+
+	HopSummary whole, merged, part, back;
+	Summarize(&rtt[0], rtt.size(), &whole);
+	merged.Clear();
+	for(size_t c = 0; c + 1 < sizeof(cut) / sizeof(cut[0]); ++c) {
+		Summarize(&rtt[cut[c]], cut[c + 1] - cut[c], &part);
+		CHECK(back.Parse(part.Serialize().c_str()));
+		merged.Merge(back);
+	}
+
+	CHECK_EQ(merged.xmit, whole.xmit);
+	CHECK_EQ(merged.returned, whole.returned);
+	CHECK_EQ(merged.total, whole.total);
+	CHECK_EQ(merged.best, whole.best);
+	CHECK_EQ(merged.worst, whole.worst);
+	CHECK_EQ(merged.n, whole.n);
+	CHECK(Near(merged.mean, whole.mean, 1e-12));
+	CHECK(Near(merged.m2, whole.m2, 1e-9));
+	CHECK(!memcmp(merged.hist, whole.hist, sizeof(whole.hist)));
+	CHECK_EQ(merged.Percent(), whole.Percent());
+	CHECK_EQ(merged.Avg(), whole.Avg());
+	CHECK(Near(merged.StdDev(), whole.StdDev(), 1e-9));
+	static const int pct[4] = { 50, 90, 95, 99 };
+	int pm[4], pw[4];
+	LatencyHistogram::Percentiles(merged.hist, pct, 4, pm);
+	LatencyHistogram::Percentiles(whole.hist, pct, 4, pw);
+	for(int i = 0; i < 4; ++i)
+		CHECK_EQ(pm[i], pw[i]);
+}
+
+static const struct {
+	const char* name;
+	void (*run)();
+} tests[] = {
+	{ "long_run", TestLongRun },
+	{ "history_round_trip", TestHistoryRoundTrip },
+	{ "summary_merge", TestSummaryMerge },
+};
+
+int main(int argc, char* argv[])
+{
+	int ran = 0;
+	for(size_t t = 0; t < sizeof(tests) / sizeof(tests[0]); ++t) {
+		if(argc > 1 && strcmp(argv[1], tests[t].name)) continue;
+		int before = failures;
+		tests[t].run();
+		printf("%s: %s\n", tests[t].name, failures == before ? "ok" : "FAILED");
+		++ran;
+	}
+	if(!ran) {
+		fprintf(stderr, "no test named %s\n", argv[1]);
+		return 2;
+	}
+	return failures ? 1 : 0;
+}
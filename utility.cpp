@@ -71,7 +71,7 @@ namespace OS
 		for (int j = 0; j < MAXHOOP; j++)
 		{
 			if (j == 0) {
-				header += "Date (UTC)" + FIELD_SEPARATOR + "ComputerName" + FIELD_SEPARATOR + "UserName" + FIELD_SEPARATOR ;
+				header += "Date (UTC)" + FIELD_SEPARATOR + "ComputerName" + FIELD_SEPARATOR + "UserName" + FIELD_SEPARATOR + "Window" + FIELD_SEPARATOR + "Trace" + FIELD_SEPARATOR;
 			}
 			for (int i = 0; i < MTR_NR_COLS; ++i)
 			{
@@ -87,7 +87,7 @@ namespace OS
 		file->WriteString(header.c_str());
 	}
 
-	CStdioFile* utility::CreateFile(const CString& folderPath)
+	CStdioFile* utility::CreateFile(const CString& folderPath, const CString& prefix)
 	{
 
 		// Get current time in UTC
@@ -103,7 +103,7 @@ namespace OS
 
 		// Create a base file name with date and time
 		CString filePath;
-		filePath.Format(_T("%s\\datalist_%s.txt"), folderPath, currentTime);
+		filePath.Format(_T("%s\\%s_%s.txt"), folderPath, prefix, currentTime);
 
 		// Ensure the directory exists
 		if (!PathFileExists(folderPath))
@@ -8,7 +8,7 @@ namespace OS
 	public:
 		static CString GetExecutableDirectory();
 		static void WriteHeader(CStdioFile* file);
-		static CStdioFile* CreateFile(const CString& folderPath);
+		static CStdioFile* CreateFile(const CString& folderPath, const CString& prefix = _T("datalist"));
 		static std::string utility::ComputerName();
 		static std::string utility::UserName();
 	};